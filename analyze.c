@@ -10,58 +10,41 @@
 #include "symtab.h"
 #include "analyze.h"
 
-/* counter for variable memory locations */
-static int location = 0;
-
-/* Procedure traverse is a generic recursive 
- * syntax tree traversal routine:
- * it applies preProc in preorder and postProc 
- * in postorder to tree pointed to by t
+/* counter for variable memory locations
+ * is kept in ctx->location
  */
-static void traverse( TreeNode * t,
-               void (* preProc) (TreeNode *),   // 这个函数用于先根遍历
-               void (* postProc) (TreeNode *) ) // 这个函数用于后根遍历
-{ if (t != NULL)
-  { preProc(t);
-    { int i;
-      for (i=0; i < MAXCHILDREN; i++)
-        traverse(t->child[i],preProc,postProc);
-    }
-    postProc(t);
-    traverse(t->sibling,preProc,postProc);
-  }
-}
 
-/* nullProc is a do-nothing procedure to 
- * generate preorder-only or postorder-only
- * traversals from traverse
+/* type errors found during the walk; they are
+ * printed once the symbol table is complete so
+ * that the listing has the same order as with
+ * separate symbol table and type checking passes
  */
-// 这个函数无所事事，两次用来填充空位
-// buildSymtab()用的是先根遍历
-// typeCheck()用的是后根遍历
-// 也是巧妙的设计
-static void nullProc(TreeNode * t)
-{ if (t==NULL) return;
-  else return;
-}
+typedef struct
+   { TreeNode * t;
+     char * message;
+   } TypeError;
+
+typedef struct
+   { TypeError * err;
+     int nerr, size;
+   } ErrorList;
 
 /* Procedure insertNode inserts 
  * identifiers stored in t into 
  * the symbol table 
  */
-static void insertNode( TreeNode * t)
+// st_insert一次探查完成查找和插入，返回的句柄记在结点上，
+// 代码生成时不必再按名字查表
+static void insertNode( Context * ctx, TreeNode * t)
 { switch (t->nodekind)
   { case StmtK: // 五种语句中，只有两种要插入符号表
       switch (t->kind.stmt)
       { case AssignK:
-        case ReadK: // 先查询，后插入
-          if (st_lookup(t->attr.name) == -1)
-          /* not yet in table, so treat as new definition */
-            st_insert(t->attr.name,t->lineno,location++);
-          else
-          /* already in table, so ignore location, 
-             add line number of use only */ 
-            st_insert(t->attr.name,t->lineno,0);
+        case ReadK:
+          t->symbol = st_insert(ctx->symtab,t->attr.name,t->lineno,ctx->location);
+          /* a new symbol gets the next handle, so it is a new definition
+             exactly when its handle equals the location counter */
+          if (t->symbol == ctx->location) ctx->location++;
           break;
         default:
           break;
@@ -69,14 +52,9 @@ static void insertNode( TreeNode * t)
       break;
     case ExpK: // 表达式中只有一种要插入符号表
       switch (t->kind.exp)
-      { case IdK:
-          if (st_lookup(t->attr.name) == -1) // 合理的新值应该出现在read/assign语句中，出现在这里不太合理
-          /* not yet in table, so treat as new definition */
-            st_insert(t->attr.name,t->lineno,location++);
-          else
-          /* already in table, so ignore location, 
-             add line number of use only */ 
-            st_insert(t->attr.name,t->lineno,0);
+      { case IdK: // 合理的新值应该出现在read/assign语句中，出现在这里不太合理
+          t->symbol = st_insert(ctx->symtab,t->attr.name,t->lineno,ctx->location);
+          if (t->symbol == ctx->location) ctx->location++;
           break;
         default:
           break;
@@ -87,34 +65,29 @@ static void insertNode( TreeNode * t)
   }
 }
 
-/* Function buildSymtab constructs the symbol 
- * table by preorder traversal of the syntax tree
- */
-void buildSymtab(TreeNode * syntaxTree)
-{ traverse(syntaxTree,insertNode,nullProc); // 传入两个函数指针
-  if (TraceAnalyze)
-  { fprintf(listing,"\nSymbol table:\n\n");
-    printSymTab(listing);
+static void typeError(Context * ctx, ErrorList * errs, TreeNode * t, char * message)
+{ if (errs->nerr >= errs->size)
+  { errs->size = errs->size ? 2*errs->size : 8;
+    errs->err = (TypeError *) realloc(errs->err,errs->size*sizeof(TypeError));
   }
-}
-
-static void typeError(TreeNode * t, char * message)
-{ fprintf(listing,"Type error at line %d: %s\n",t->lineno,message);
-  Error = TRUE; // 全局变量
+  errs->err[errs->nerr].t = t;
+  errs->err[errs->nerr].message = message;
+  errs->nerr++;
+  ctx->Error = TRUE; // 记录在本次编译的Context中
 }
 
 /* Procedure checkNode performs
  * type checking at a single tree node
  */
 // 两个任务：标记类型/检查类型
-static void checkNode(TreeNode * t)
+static void checkNode(Context * ctx, ErrorList * errs, TreeNode * t)
 { switch (t->nodekind)
   { case ExpK:
       switch (t->kind.exp)
       { case OpK: // 表达式根据符号来检查类型
           if ((t->child[0]->type != Integer) ||
               (t->child[1]->type != Integer))
-            typeError(t,"Op applied to non-integer"); // 错误处理1
+            typeError(ctx,errs,t,"Op applied to non-integer"); // 错误处理1
           if ((t->attr.op == EQ) || (t->attr.op == LT))
             t->type = Boolean; // 标记类型
           else
@@ -132,19 +105,19 @@ static void checkNode(TreeNode * t)
       switch (t->kind.stmt)
       { case IfK:
           if (t->child[0]->type == Integer)
-            typeError(t->child[0],"if test is not Boolean"); // 错误处理2～5
+            typeError(ctx,errs,t->child[0],"if test is not Boolean"); // 错误处理2～5
           break;
         case AssignK:
           if (t->child[0]->type != Integer)
-            typeError(t->child[0],"assignment of non-integer value");
+            typeError(ctx,errs,t->child[0],"assignment of non-integer value");
           break;
         case WriteK:
           if (t->child[0]->type != Integer)
-            typeError(t->child[0],"write of non-integer value");
+            typeError(ctx,errs,t->child[0],"write of non-integer value");
           break;
         case RepeatK:
           if (t->child[1]->type == Integer)
-            typeError(t->child[1],"repeat test is not Boolean");
+            typeError(ctx,errs,t->child[1],"repeat test is not Boolean");
           break;
         default:
           break;
@@ -156,9 +129,42 @@ static void checkNode(TreeNode * t)
   }
 }
 
-/* Procedure typeCheck performs type checking 
- * by a postorder syntax tree traversal
+/* Procedure analyzeTree inserts the identifiers of
+ * t and its siblings into the symbol table in
+ * preorder and type checks them in postorder,
+ * in a single walk of the tree
+ */
+// 兄弟结点用循环而不是递归，长语句序列不会耗尽栈
+static void analyzeTree(Context * ctx, ErrorList * errs, TreeNode * t)
+{ int i;
+  while (t != NULL)
+  { insertNode(ctx,t);
+    for (i=0; i < MAXCHILDREN; i++)
+      analyzeTree(ctx,errs,t->child[i]);
+    checkNode(ctx,errs,t);
+    t = t->sibling;
+  }
+}
+
+/* Procedure analyze constructs the symbol table
+ * and performs type checking of the syntax tree
  */
-void typeCheck(TreeNode * syntaxTree)
-{ traverse(syntaxTree,nullProc,checkNode); // 传入两个函数指针
+void analyze(Context * ctx, TreeNode * syntaxTree)
+{ ErrorList errs;
+  int i;
+  errs.err = NULL;
+  errs.nerr = errs.size = 0;
+  st_reset(ctx->symtab); // 每次编译都从空表开始
+  ctx->location = 0;
+  analyzeTree(ctx,&errs,syntaxTree);
+  st_freeze(ctx->symtab); // 表已建好，压缩行号
+  if (TraceAnalyze)
+  { fprintf(ctx->listing,"\nSymbol table:\n\n");
+    printSymTab(ctx->symtab,ctx->listing);
+    fprintf(ctx->listing,"\nChecking Types...\n");
+  }
+  for (i=0; i < errs.nerr; i++)
+    fprintf(ctx->listing,"Type error at line %d: %s\n",
+            errs.err[i].t->lineno,errs.err[i].message);
+  free(errs.err);
 }
@@ -8,14 +8,9 @@
 #ifndef _ANALYZE_H_
 #define _ANALYZE_H_
 
-/* Function buildSymtab constructs the symbol 
- * table by preorder traversal of the syntax tree
+/* Procedure analyze constructs the symbol table
+ * and performs type checking of the syntax tree
  */
-void buildSymtab(TreeNode *);
-
-/* Procedure typeCheck performs type checking 
- * by a postorder syntax tree traversal
- */
-void typeCheck(TreeNode *);
+void analyze(Context *, TreeNode *);
 
 #endif
@@ -11,160 +11,620 @@
 #include "symtab.h"
 #include "code.h"
 #include "cgen.h"
+#include "peep.h"
+#include "ir.h"
+#include "profile.h"
+#include <limits.h>
 
-/* tmpOffset is the memory offset for temps
+/* ctx->tmpReg is the next free temporary
+   register (tmpFirst..ctx->tmpTop); temps are
+   kept in registers while any are free
+*/
+// 中间值优先放在2/3/4号寄存器中，用完了才压到内存栈上
+
+/* ctx->tmpOffset is the memory offset for temps
    It is decremented each time a temp is
    stored, and incremeted when loaded again
 */
 // 维护内存高地址部分，存放中间变量，有点像栈
-static int tmpOffset = 0;
 
-/* prototype for internal recursive code generator */
-static void cGen (TreeNode * tree);
+/* prototypes for internal recursive code generator */
+static void cGen (Context * ctx, TreeNode * tree);
+static void genExp (Context * ctx, TreeNode * tree, int dst);
+
+/* Function promoted returns the register holding
+ * the variable if t is an IdK node for a variable
+ * kept in a register, otherwise 0 (ac never holds
+ * a variable)
+ */
+static int promoted( Context * ctx, TreeNode * t)
+{ return (t->kind.exp == IdK) ? ctx->varReg[t->symbol] : 0; }
+
+/* the operand patterns of the selection rules */
+typedef enum
+   { AnyOp, /* any expression, evaluated into ac */
+     RegOp, /* a variable kept in a register */
+     LeafOp, /* a constant or a variable in memory */
+     ConstOp, /* a constant other than INT_MIN */
+     ZeroOp /* the constant 0 */
+   } Pattern;
+
+/* the ways of generating code for an operator */
+typedef enum
+   { SelAddConst, /* LDA: e + c, c + e or e - c */
+     SelTestZero, /* jump on e itself: e < 0, e = 0 */
+     SelTestConst, /* LDA -c(e), jump: e < c, e = c */
+     SelLoadLeaf, /* the other operand, then the leaf into ac1 */
+     SelOperands /* both operands through genOperands */
+   } Selection;
+
+/* a rule matches an OpK node whose operator is
+ * in ops and whose operands match left and right;
+ * cost is the number of instructions it emits
+ * besides those evaluating its AnyOp operands
+ */
+typedef struct
+   { int ops; /* one bit per TokenType */
+     Pattern left, right;
+     int cost;
+     int level; /* the least OptLevel using the rule */
+     int test; /* TRUE if only for the test of an if or repeat */
+     Selection sel;
+   } Rule;
+
+#define OPS(op) (1 << (op))
+#define ANYOP (OPS(PLUS)|OPS(MINUS)|OPS(TIMES)|OPS(OVER)|OPS(LT)|OPS(EQ))
+
+// TM没有立即数运算，但LDA r,d(s)计算d+reg(s)，加减常数只需一条指令；
+// 比较按TM的做法是(a-b)<0，所以只有e<0和e=0能直接跳转，0<e在e=INT_MIN时与e>0不同，
+// 不能用JGT
+static Rule rules[] =
+   { /* ops               left     right    cost lvl test   sel */
+     { OPS(PLUS)|OPS(MINUS),AnyOp, ConstOp, 1,  1, FALSE, SelAddConst },
+     { OPS(PLUS),         ConstOp, AnyOp,   1,  1, FALSE, SelAddConst },
+     { OPS(LT)|OPS(EQ),   AnyOp,   ZeroOp,  0,  1, TRUE,  SelTestZero },
+     { OPS(EQ),           ZeroOp,  AnyOp,   0,  1, TRUE,  SelTestZero },
+     { OPS(LT)|OPS(EQ),   AnyOp,   ConstOp, 1,  1, TRUE,  SelTestConst },
+     { OPS(EQ),           ConstOp, AnyOp,   1,  1, TRUE,  SelTestConst },
+     { ANYOP,             AnyOp,   RegOp,   1,  0, FALSE, SelOperands },
+     { ANYOP,             RegOp,   AnyOp,   1,  0, FALSE, SelOperands },
+     { ANYOP,             AnyOp,   LeafOp,  2,  1, FALSE, SelLoadLeaf },
+     { ANYOP,             LeafOp,  AnyOp,   2,  1, FALSE, SelLoadLeaf },
+     { ANYOP,             AnyOp,   AnyOp,   2,  0, FALSE, SelOperands }
+   };
+
+#define NRULES ((int) (sizeof(rules)/sizeof(rules[0])))
+
+/* Function matches returns TRUE if expression t
+ * matches operand pattern pat
+ */
+static int matches( Context * ctx, TreeNode * t, Pattern pat)
+{ switch (pat)
+  { case RegOp: return promoted(ctx,t) != 0;
+    case LeafOp:
+      return (t->kind.exp == ConstK) ||
+             ((t->kind.exp == IdK) && ! promoted(ctx,t));
+    case ConstOp: return (t->kind.exp == ConstK) && (t->attr.val != INT_MIN);
+    case ZeroOp: return (t->kind.exp == ConstK) && (t->attr.val == 0);
+    default: return TRUE;
+  }
+}
+
+/* Function opCost returns the cost of evaluating
+ * operand t matched as pat into ac: one load for
+ * a leaf. An operator node only matches AnyOp, so
+ * its cost is the same under every rule and is
+ * left out
+ */
+static int opCost( Context * ctx, TreeNode * t, Pattern pat)
+{ return ((pat == AnyOp) && matches(ctx,t,LeafOp)) ? 1 : 0; }
+
+/* Function selectRule returns the cheapest rule for
+ * OpK node t; test is TRUE for the test of an if
+ * or repeat. Earlier rules win ties
+ */
+static Rule * selectRule( Context * ctx, TreeNode * t, int test)
+{ Rule * best = NULL;
+  int i, cost, least = INT_MAX;
+  for (i=0;i<NRULES;i++)
+  { Rule * r = &rules[i];
+    if (! (r->ops & OPS(t->attr.op)) || (r->level > OptLevel) ||
+        (r->test && ! test) ||
+        ! matches(ctx,t->child[0],r->left) ||
+        ! matches(ctx,t->child[1],r->right))
+      continue;
+    cost = r->cost + opCost(ctx,t->child[0],r->left) +
+           opCost(ctx,t->child[1],r->right);
+    if (cost < least)
+    { best = r;
+      least = cost;
+    }
+  }
+  return best; /* the last rule matches anything */
+}
+
+/* Function label sets the need of every node of
+ * expression tree t, the number of temporaries
+ * (registers or stack slots) used to evaluate it
+ * into ac, and returns the need of t; test is
+ * TRUE for the test of an if or repeat. Only the
+ * SelOperands rules hold an operand in a
+ * temporary while the other one is evaluated, so
+ * the one needing more goes first (Sethi-Ullman)
+ */
+static int label( Context * ctx, TreeNode * t, int test)
+{ int l, r;
+  if ((OptLevel < 1) || (t->kind.exp != OpK)) /* -O0 keeps the order */
+    return t->need = 0;
+  l = label(ctx,t->child[0],FALSE);
+  r = label(ctx,t->child[1],FALSE);
+  if ((selectRule(ctx,t,test)->sel != SelOperands) ||
+      promoted(ctx,t->child[0]) || promoted(ctx,t->child[1]))
+    t->need = (l > r) ? l : r; /* the other one is 0 */
+  else if (l == r)
+    t->need = l + 1;
+  else
+    t->need = (l > r) ? l : r;
+  return t->need;
+}
+
+/* Function genOperand generates code for
+ * expression t unless it is a variable kept in a
+ * register, and returns the register holding
+ * its value
+ */
+static int genOperand( Context * ctx, TreeNode * t)
+{ int r = promoted(ctx,t);
+  if (r == 0)
+  { cGen(ctx,t);
+    r = ac;
+  }
+  return r;
+}
+
+/* Function genOperands generates code for both
+ * operands of OpK node tree as rule r says: for
+ * SelLoadLeaf the leaf is loaded into ac1 after
+ * the other operand, otherwise the operand
+ * needing more temporaries goes first (see
+ * label). The register holding the right operand
+ * is stored in *right; the register holding the
+ * left operand is returned
+ */
+// 操作数的求值顺序不影响结果（表达式唯一的副作用是除以0停机，停机信息相同），
+// TM的指令是三地址的，先算右操作数时也不必交换指令中的操作数
+static int genOperands( Context * ctx, TreeNode * tree, Rule * r, int * right)
+{ int reg[2]; /* the registers holding the operands */
+  int first = 0, saved = FALSE;
+  if (r->sel == SelLoadLeaf)
+  { TreeNode * leaf;
+    first = (r->right == LeafOp) ? 0 : 1; /* the other operand */
+    reg[first] = genOperand(ctx,tree->child[first]);
+    leaf = tree->child[1-first];
+    if (leaf->kind.exp == ConstK)
+      emitRM(ctx,opLDC,ac1,leaf->attr.val,0,"op: load const operand");
+    else
+      emitRM(ctx,opLD,ac1,st_loc(ctx->symtab,leaf->symbol),gp,
+             "op: load id operand");
+    reg[1-first] = ac1;
+    *right = reg[1];
+    return reg[0];
+  }
+  reg[0] = promoted(ctx,tree->child[0]);
+  reg[1] = promoted(ctx,tree->child[1]);
+  if ((OptLevel >= 1) && (reg[0] == 0) && (reg[1] == 0) &&
+      (tree->child[1]->need > tree->child[0]->need))
+    first = 1;
+  if (reg[first] == 0)
+  { /* gen code for ac = first operand */
+    cGen(ctx,tree->child[first]);
+    reg[first] = ac;
+  }
+  if ((reg[first] == ac) && (reg[1-first] == 0))
+  { /* gen code to save first operand */
+    // 先算的操作数在ac中，有空闲寄存器就复制过去，否则压栈
+    saved = TRUE;
+    if ((OptLevel >= 1) && (ctx->tmpReg <= ctx->tmpTop))
+    { reg[first] = ctx->tmpReg++;
+      emitRM(ctx,opLDA,reg[first],0,ac,first ? "op: save right" : "op: save left");
+    }
+    else
+    { reg[first] = ac1;
+      emitRM(ctx,opST,ac,ctx->tmpOffset--,mp,first ? "op: push right" : "op: push left");
+    }
+  }
+  if (reg[1-first] == 0)
+  { /* gen code for ac = second operand */
+    cGen(ctx,tree->child[1-first]);
+    reg[1-first] = ac;
+  }
+  /* now load first operand */
+  // 后算的操作数在ac中，先算的在寄存器中，压过栈的出栈到ac1
+  if (reg[first] == ac1)
+    emitRM(ctx,opLD,ac1,++ctx->tmpOffset,mp,first ? "op: load right" : "op: load left");
+  else if (saved)
+    ctx->tmpReg--;
+  *right = reg[1];
+  return reg[0];
+}
+
+/* Function genTest generates code for the test
+ * of an if or repeat statement and returns the
+ * jump opcode that branches on register *reg
+ * when the test is false
+ */
+// 比较直接接条件跳转，不必先算出0/1再用JEQ判断
+static OpCode genTest( Context * ctx, TreeNode * tree, int * reg)
+{ int left, right, k;
+  Rule * r;
+  *reg = ac;
+  if ((OptLevel >= 1) && (tree->nodekind == ExpK) && (tree->kind.exp == OpK) &&
+      ((tree->attr.op == LT) || (tree->attr.op == EQ)))
+  { if (TraceCode) emitComment(ctx,"-> Op") ;
+    label(ctx,tree,TRUE);
+    r = selectRule(ctx,tree,TRUE);
+    if ((r->sel == SelTestZero) || (r->sel == SelTestConst))
+    { k = (r->left == AnyOp) ? 0 : 1; /* the operand compared */
+      *reg = genOperand(ctx,tree->child[k]);
+      if (r->sel == SelTestConst)
+      { emitRM(ctx,opLDA,ac,-tree->child[1-k]->attr.val,*reg,
+               tree->attr.op == LT ? "op < const" : "op == const");
+        *reg = ac;
+      }
+    }
+    else
+    { left = genOperands(ctx,tree,r,&right);
+      if (tree->attr.op == LT)
+        emitRO(ctx,opSUB,ac,left,right,"op <") ;
+      else
+        emitRO(ctx,opSUB,ac,left,right,"op ==") ;
+    }
+    if (TraceCode) emitComment(ctx,"<- Op") ;
+    /* false: left-right >= 0 for <, != 0 for = */
+    return tree->attr.op == LT ? opJGE : opJNE;
+  }
+  label(ctx,tree,FALSE);
+  cGen(ctx,tree);
+  return opJEQ; /* false is 0 */
+}
+
+/* Function negate returns the jump opcode taken
+ * exactly when jump op is not
+ */
+static OpCode negate( OpCode op)
+{ switch (op)
+  { case opJLT: return opJGE;
+    case opJGE: return opJLT;
+    case opJEQ: return opJNE;
+    case opJNE: return opJEQ;
+    case opJLE: return opJGT;
+    default: return opJLE; /* opJGT */
+  }
+}
+
+/* PROMOTEMIN = the least weight of a variable
+ * kept in a register for a loop: one occurrence
+ * at the level of the loop weighs 1, in a loop
+ * nested inside it 10, and so on. With a profile
+ * an occurrence weighs the number of times it
+ * was executed, and must outweigh the load and
+ * store each time the loop is entered
+ */
+#define PROMOTEMIN 2
+
+/* MAXWEIGHT bounds the weight of one occurrence */
+#define MAXWEIGHT 100000L
+
+/* Procedure weighExp adds w to the weight of
+ * every variable occurring in expression t
+ */
+static void weighExp( long * weight, TreeNode * t, long w)
+{ if (t == NULL) return;
+  if (t->kind.exp == IdK) weight[t->symbol] += w;
+  else if (t->kind.exp == OpK)
+  { weighExp(weight,t->child[0],w);
+    weighExp(weight,t->child[1],w);
+  }
+}
+
+/* Procedure weighStmts adds to the weight of the
+ * variables their occurrences in the statement
+ * sequence t, each weighing w, ten times as much
+ * in a nested repeat loop; the profile, if any,
+ * gives the weight of the parts of if and repeat
+ * statements instead
+ */
+// 没有运行时的统计时，用循环嵌套深度估计执行频率：每深一层算10倍
+static void weighStmts( Context * ctx, long * weight, TreeNode * t, long w)
+{ long inner = (w < MAXWEIGHT) ? 10*w : w;
+  long count, ntrue;
+  for (;t != NULL;t=t->sibling)
+    switch (t->kind.stmt)
+    { case IfK:
+        weighExp(weight,t->child[0],w);
+        if (siteCounts(ctx,t->site,&count,&ntrue))
+        { weighStmts(ctx,weight,t->child[1],ntrue);
+          weighStmts(ctx,weight,t->child[2],count-ntrue);
+          break;
+        }
+        weighStmts(ctx,weight,t->child[1],w);
+        weighStmts(ctx,weight,t->child[2],w);
+        break;
+      case RepeatK:
+        if (! siteCounts(ctx,t->site,&count,&ntrue)) count = inner;
+        weighStmts(ctx,weight,t->child[0],count);
+        weighExp(weight,t->child[1],count);
+        break;
+      case AssignK:
+        weight[t->symbol] += w;
+        weighExp(weight,t->child[0],w);
+        break;
+      case ReadK:
+        weight[t->symbol] += w;
+        break;
+      case WriteK:
+        weighExp(weight,t->child[0],w);
+        break;
+      default:
+        break;
+    }
+}
+
+/* Function assigns returns TRUE if the statement
+ * sequence t assigns or reads variable v
+ */
+static int assigns( TreeNode * t, int v)
+{ for (;t != NULL;t=t->sibling)
+    switch (t->kind.stmt)
+    { case IfK:
+        if (assigns(t->child[1],v) || assigns(t->child[2],v)) return TRUE;
+        break;
+      case RepeatK:
+        if (assigns(t->child[0],v)) return TRUE;
+        break;
+      case AssignK:
+      case ReadK:
+        if (t->symbol == v) return TRUE;
+        break;
+      default:
+        break;
+    }
+  return FALSE;
+}
+
+/* Procedure promote keeps the variables used most
+ * in repeat loop tree in registers taken from
+ * the top of the temporaries, leaving at least
+ * one for expression evaluation, and loads them
+ */
+// 寄存器提升：外层循环先挑，内层循环的使用按嵌套深度加权计入，
+// 所以最内层的热点变量在最外层就被装入寄存器，进出循环只各付一次代价；
+// 内层循环再用剩下的寄存器。循环中变量只在寄存器里，read直接读入寄存器
+static void promote( Context * ctx, TreeNode * tree)
+{ long * weight;
+  long count, ntrue, least = PROMOTEMIN;
+  int v, best;
+  if (ctx->tmpTop <= tmpFirst) return;
+  weight = (long *) calloc(ctx->location,sizeof(long));
+  if (siteCounts(ctx,tree->site,&count,&ntrue))
+  { /* ntrue = the number of times the loop was left */
+    weighStmts(ctx,weight,tree->child[0],count);
+    weighExp(weight,tree->child[1],count);
+    least = 2*ntrue+1;
+  }
+  else
+  { weighStmts(ctx,weight,tree->child[0],1);
+    weighExp(weight,tree->child[1],1);
+  }
+  while (ctx->tmpTop > tmpFirst)
+  { best = -1;
+    for (v=0;v<ctx->location;v++)
+      if ((ctx->varReg[v] == 0) && (weight[v] >= least) &&
+          ((best < 0) || (weight[v] > weight[best])))
+        best = v;
+    if (best < 0) break;
+    ctx->varReg[best] = ctx->tmpTop--;
+    emitRM(ctx,opLD,ctx->varReg[best],st_loc(ctx->symtab,best),gp,
+           "promote: load variable");
+  }
+  free(weight);
+}
+
+/* Procedure demote stores back the variables
+ * promote kept in registers above top for repeat
+ * loop tree, if the loop changed them
+ */
+static void demote( Context * ctx, TreeNode * tree, int top)
+{ int v;
+  for (v=0;v<ctx->location;v++)
+    if ((ctx->varReg[v] > ctx->tmpTop) && (ctx->varReg[v] <= top))
+    { if (assigns(tree->child[0],v))
+        emitRM(ctx,opST,ctx->varReg[v],st_loc(ctx->symtab,v),gp,
+               "demote: store variable");
+      ctx->varReg[v] = 0;
+    }
+  ctx->tmpTop = top;
+}
 
 /* Procedure genStmt generates code at a statement node */
-static void genStmt( TreeNode * tree)
+static void genStmt( Context * ctx, TreeNode * tree)
 { TreeNode * p1, * p2, * p3;
   int savedLoc1,savedLoc2,currentLoc;
-  int loc;
+  OpCode jmpFalse; /* jump taken when the test is false */
+  int testReg; /* the register jmpFalse tests */
+  int loc, r, top, swap;
   switch (tree->kind.stmt) {
 
       case IfK :
-         if (TraceCode) emitComment("-> if") ;
+         if (TraceCode) emitComment(ctx,"-> if") ;
          p1 = tree->child[0] ;
          p2 = tree->child[1] ;
          p3 = tree->child[2] ;
+         swap = (OptLevel >= 1) && hotThen(ctx,tree);
+         if (swap) /* the then part runs more: place it last */
+         { p2 = tree->child[2] ;
+           p3 = tree->child[1] ;
+         }
          /* generate code for test expression */
-         cGen(p1);
-         savedLoc1 = emitSkip(1) ; // 保存地址1
-         emitComment("if: jump to else belongs here");
+         jmpFalse = genTest(ctx,p1,&testReg);
+         if (swap) jmpFalse = negate(jmpFalse); /* now jumps when true */
+         savedLoc1 = emitSkip(ctx,1) ; // 保存地址1
+         emitComment(ctx,"if: jump to else belongs here");
          /* recurse on then part */
-         cGen(p2);
-         savedLoc2 = emitSkip(1) ; // 保存地址2
-         emitComment("if: jump to end belongs here");
-         currentLoc = emitSkip(0) ; // 拿到当前地址
-         emitBackup(savedLoc1) ; // 地址回填1
-         emitRM_Abs("JEQ",ac,currentLoc,"if: jmp to else");
-         emitRestore() ;
+         cGen(ctx,p2);
+         savedLoc2 = emitSkip(ctx,1) ; // 保存地址2
+         emitComment(ctx,"if: jump to end belongs here");
+         currentLoc = emitSkip(ctx,0) ; // 拿到当前地址
+         emitBackup(ctx,savedLoc1) ; // 地址回填1
+         emitSite(ctx,tree->site,swap);
+         emitRM_Abs(ctx,jmpFalse,testReg,currentLoc,
+                    swap ? "if: jmp to then" : "if: jmp to else");
+         emitRestore(ctx) ;
          /* recurse on else part */
-         cGen(p3);
-         currentLoc = emitSkip(0) ;
-         emitBackup(savedLoc2) ; // 地址回填2
-         emitRM_Abs("LDA",pc,currentLoc,"jmp to end") ;
-         emitRestore() ;
-         if (TraceCode)  emitComment("<- if") ;
+         cGen(ctx,p3);
+         currentLoc = emitSkip(ctx,0) ;
+         emitBackup(ctx,savedLoc2) ; // 地址回填2
+         emitRM_Abs(ctx,opLDA,pc,currentLoc,"jmp to end") ;
+         emitRestore(ctx) ;
+         if (TraceCode)  emitComment(ctx,"<- if") ;
          break; /* if_k */
 
       case RepeatK:
-         if (TraceCode) emitComment("-> repeat") ;
+         if (TraceCode) emitComment(ctx,"-> repeat") ;
          p1 = tree->child[0] ;
          p2 = tree->child[1] ;
-         savedLoc1 = emitSkip(0); // 保存地址
-         emitComment("repeat: jump after body comes back here");
+         top = ctx->tmpTop;
+         if (OptLevel >= 1) promote(ctx,tree);
+         savedLoc1 = emitSkip(ctx,0); // 保存地址
+         emitComment(ctx,"repeat: jump after body comes back here");
          /* generate code for body */
-         cGen(p1);
+         cGen(ctx,p1);
          /* generate code for test */
-         cGen(p2);
+         jmpFalse = genTest(ctx,p2,&testReg);
          // 这个不是回填地址，是在当前位置写入保存地址
          // 用到_Abs()的只有三处，另外两处在上面IfK中，用到_Abs()的原因是没有zero寄存器
-         emitRM_Abs("JEQ",ac,savedLoc1,"repeat: jmp back to body");
-         if (TraceCode)  emitComment("<- repeat") ;
+         emitSite(ctx,tree->site,FALSE);
+         emitRM_Abs(ctx,jmpFalse,testReg,savedLoc1,"repeat: jmp back to body");
+         demote(ctx,tree,top);
+         if (TraceCode)  emitComment(ctx,"<- repeat") ;
          break; /* repeat */
 
       case AssignK:
-         if (TraceCode) emitComment("-> assign") ;
-         /* generate code for rhs */
-         cGen(tree->child[0]);
-         /* now store value */
-         loc = st_lookup(tree->attr.name); // 查变量表
-         emitRM("ST",ac,loc,gp,"assign: store value"); // 结果值放在ac寄存器
-         if (TraceCode)  emitComment("<- assign") ;
+         if (TraceCode) emitComment(ctx,"-> assign") ;
+         label(ctx,tree->child[0],FALSE);
+         if ((r = ctx->varReg[tree->symbol]) != 0)
+           genExp(ctx,tree->child[0],r); /* straight into its register */
+         else
+         { /* generate code for rhs */
+           cGen(ctx,tree->child[0]);
+           /* now store value */
+           loc = st_loc(ctx->symtab,tree->symbol); // 查变量表
+           emitRM(ctx,opST,ac,loc,gp,"assign: store value"); // 结果值放在ac寄存器
+         }
+         if (TraceCode)  emitComment(ctx,"<- assign") ;
          break; /* assign_k */
 
       case ReadK:
-         emitRO("IN",ac,0,0,"read integer value"); // 读入值放在ac中
-         loc = st_lookup(tree->attr.name); // 查变量表
-         emitRM("ST",ac,loc,gp,"read: store value"); // 再从ac写回变量
+         if ((r = ctx->varReg[tree->symbol]) != 0)
+         { emitRO(ctx,opIN,r,0,0,"read integer value into register");
+           break;
+         }
+         emitRO(ctx,opIN,ac,0,0,"read integer value"); // 读入值放在ac中
+         loc = st_loc(ctx->symtab,tree->symbol); // 查变量表
+         emitRM(ctx,opST,ac,loc,gp,"read: store value"); // 再从ac写回变量
          break;
       case WriteK:
+         label(ctx,tree->child[0],FALSE);
+         if ((r = promoted(ctx,tree->child[0])) != 0)
+         { emitRO(ctx,opOUT,r,0,0,"write register");
+           break;
+         }
          /* generate code for expression to write */
-         cGen(tree->child[0]);
+         cGen(ctx,tree->child[0]);
          /* now output it */
-         emitRO("OUT",ac,0,0,"write ac"); // 要输出的值在ac中
+         emitRO(ctx,opOUT,ac,0,0,"write ac"); // 要输出的值在ac中
          break;
       default:
          break;
     }
 } /* genStmt */
 
-/* Procedure genExp generates code at an expression node */
-static void genExp( TreeNode * tree)
-{ int loc;
-  TreeNode * p1, * p2;
+/* Procedure genExp generates code at an expression
+ * node, leaving the value in register dst
+ */
+static void genExp( Context * ctx, TreeNode * tree, int dst)
+{ int loc, left, right, k;
+  Rule * rule;
   switch (tree->kind.exp) {
 
     case ConstK :
-      if (TraceCode) emitComment("-> Const") ;
+      if (TraceCode) emitComment(ctx,"-> Const") ;
       /* gen code to load integer constant using LDC */
-      emitRM("LDC",ac,tree->attr.val,0,"load const");
-      if (TraceCode)  emitComment("<- Const") ;
+      emitRM(ctx,opLDC,dst,tree->attr.val,0,"load const");
+      if (TraceCode)  emitComment(ctx,"<- Const") ;
       break; /* ConstK */
     
     case IdK :
-      if (TraceCode) emitComment("-> Id") ;
-      loc = st_lookup(tree->attr.name);
-      emitRM("LD",ac,loc,gp,"load id value");
-      if (TraceCode)  emitComment("<- Id") ;
+      if (TraceCode) emitComment(ctx,"-> Id") ;
+      if ((k = promoted(ctx,tree)) != 0)
+      { if (k != dst) emitRM(ctx,opLDA,dst,0,k,"load id from register");
+      }
+      else
+      { loc = st_loc(ctx->symtab,tree->symbol);
+        emitRM(ctx,opLD,dst,loc,gp,"load id value");
+      }
+      if (TraceCode)  emitComment(ctx,"<- Id") ;
       break; /* IdK */
 
     case OpK :
-         if (TraceCode) emitComment("-> Op") ;
-         p1 = tree->child[0];
-         p2 = tree->child[1];
-         /* gen code for ac = left arg */
-         cGen(p1);
-         /* gen code to push left operand */
-         // p1的结果在ac中，先压栈
-         emitRM("ST",ac,tmpOffset--,mp,"op: push left");
-         /* gen code for ac = right operand */
-         cGen(p2);
-         /* now load left operand */
-         // p2的结果在ac中，出栈把p1的结果交给ac2
-         emitRM("LD",ac1,++tmpOffset,mp,"op: load left"); // 唯一用到ac1
+         if (TraceCode) emitComment(ctx,"-> Op") ;
+         rule = selectRule(ctx,tree,FALSE);
+         if (rule->sel == SelAddConst)
+         { /* e + c, c + e and e - c: LDA adds d to a register */
+           k = (rule->right == ConstOp) ? 1 : 0; /* the constant */
+           left = genOperand(ctx,tree->child[1-k]);
+           if (tree->attr.op == PLUS)
+             emitRM(ctx,opLDA,dst,tree->child[k]->attr.val,left,"op + const");
+           else
+             emitRM(ctx,opLDA,dst,-tree->child[k]->attr.val,left,"op - const");
+           if (TraceCode)  emitComment(ctx,"<- Op") ;
+           break;
+         }
+         left = genOperands(ctx,tree,rule,&right);
          switch (tree->attr.op) {
             case PLUS :
-               emitRO("ADD",ac,ac1,ac,"op +"); // 仿x86
+               emitRO(ctx,opADD,dst,left,right,"op +"); // 仿x86
                break;
             case MINUS :
-               emitRO("SUB",ac,ac1,ac,"op -");
+               emitRO(ctx,opSUB,dst,left,right,"op -");
                break;
             case TIMES :
-               emitRO("MUL",ac,ac1,ac,"op *");
+               emitRO(ctx,opMUL,dst,left,right,"op *");
                break;
             case OVER :
-               emitRO("DIV",ac,ac1,ac,"op /");
+               emitRO(ctx,opDIV,dst,left,right,"op /");
                break;
             case LT :
                // 比较大小颇麻烦，需要五条语句，包含两个跳转，相对偏移地址都比较简单。
                // bool值的处理，0代表false，1代表true
-               emitRO("SUB",ac,ac1,ac,"op <") ;
-               emitRM("JLT",ac,2,pc,"br if true") ;
-               emitRM("LDC",ac,0,ac,"false case") ;
-               emitRM("LDA",pc,1,pc,"unconditional jmp") ;
-               emitRM("LDC",ac,1,ac,"true case") ;
+               emitRO(ctx,opSUB,dst,left,right,"op <") ;
+               emitRM(ctx,opJLT,dst,2,pc,"br if true") ;
+               emitRM(ctx,opLDC,dst,0,dst,"false case") ;
+               emitRM(ctx,opLDA,pc,1,pc,"unconditional jmp") ;
+               emitRM(ctx,opLDC,dst,1,dst,"true case") ;
                break;
             case EQ :
-               emitRO("SUB",ac,ac1,ac,"op ==") ;
-               emitRM("JEQ",ac,2,pc,"br if true");
-               emitRM("LDC",ac,0,ac,"false case") ;
-               emitRM("LDA",pc,1,pc,"unconditional jmp") ;
-               emitRM("LDC",ac,1,ac,"true case") ;
+               emitRO(ctx,opSUB,dst,left,right,"op ==") ;
+               emitRM(ctx,opJEQ,dst,2,pc,"br if true");
+               emitRM(ctx,opLDC,dst,0,dst,"false case") ;
+               emitRM(ctx,opLDA,pc,1,pc,"unconditional jmp") ;
+               emitRM(ctx,opLDC,dst,1,dst,"true case") ;
                break;
             default:
-               emitComment("BUG: Unknown operator");
+               emitComment(ctx,"BUG: Unknown operator");
                break;
          } /* case op */
-         if (TraceCode)  emitComment("<- Op") ;
+         if (TraceCode)  emitComment(ctx,"<- Op") ;
          break; /* OpK */
 
     default:
@@ -175,19 +635,19 @@ static void genExp( TreeNode * tree)
 /* Procedure cGen recursively generates code by
  * tree traversal
  */
-static void cGen( TreeNode * tree)
+static void cGen( Context * ctx, TreeNode * tree)
 { if (tree != NULL)
   { switch (tree->nodekind) {
       case StmtK:
-        genStmt(tree);
+        genStmt(ctx,tree);
         break;
       case ExpK:
-        genExp(tree);
+        genExp(ctx,tree,ac);
         break;
       default:
         break;
     }
-    cGen(tree->sibling); // 这里只有对兄弟结点的遍历，而对子结点的遍历在上面两个函数里
+    cGen(ctx,tree->sibling); // 这里只有对兄弟结点的遍历，而对子结点的遍历在上面两个函数里
   }
 }
 
@@ -200,26 +660,38 @@ static void cGen( TreeNode * tree)
  * of the code file, and is used to print the
  * file name as a comment in the code file
  */
-void codeGen(TreeNode * syntaxTree, char * codefile)
+void codeGen(Context * ctx, TreeNode * syntaxTree, char * codefile)
 {
    // 调试信息
    char * s = malloc(strlen(codefile)+7);
+   emitReset(ctx);
+   ctx->tmpOffset = 0;
+   ctx->tmpReg = tmpFirst;
+   ctx->tmpTop = tmpLast;
+   ctx->varReg = (int *) calloc(ctx->location,sizeof(int));
    strcpy(s,"File: ");
    strcat(s,codefile);
-   emitComment("TINY Compilation to TM Code");
-   emitComment(s);
+   emitComment(ctx,"TINY Compilation to TM Code");
+   emitComment(ctx,s);
 
    /* generate standard prelude */
    // 将内存0处的最大值读入mp，并清零
-   emitComment("Standard prelude:");
-   emitRM("LD",mp,0,ac,"load maxaddress from location 0");
-   emitRM("ST",ac,0,ac,"clear location 0");
-   emitComment("End of standard prelude.");
+   emitComment(ctx,"Standard prelude:");
+   emitRM(ctx,opLD,mp,0,ac,"load maxaddress from location 0");
+   emitRM(ctx,opST,ac,0,ac,"clear location 0");
+   emitComment(ctx,"End of standard prelude.");
 
    /* generate code for TINY program */
-   cGen(syntaxTree);
+   if (OptLevel >= 2) irCodeGen(ctx,syntaxTree); // 经过SSA中间表示
+   else cGen(ctx,syntaxTree);
 
    /* finish */
-   emitComment("End of execution.");
-   emitRO("HALT",0,0,0,"");
+   emitComment(ctx,"End of execution.");
+   emitRO(ctx,opHALT,0,0,0,"");
+   if (OptLevel >= 1) peephole(ctx); // 写出之前做窥孔优化
+   writeCode(ctx); // 整个程序一次写出
+   freeCode(ctx);
+   free(ctx->varReg);
+   ctx->varReg = NULL;
+   free(s);
 }
@@ -8,23 +8,109 @@
 
 #include "globals.h"
 #include "code.h"
+#include <stdarg.h>
 
-/* TM location number for current instruction emission */
+/* ctx->emitLoc is the TM location number for
+   current instruction emission */
 // 记录当前位置/当前行号
-static int emitLoc = 0 ;
 
-/* Highest TM location emitted so far
-   For use in conjunction with emitSkip,
-   emitBackup, and emitRestore */
+/* ctx->highEmitLoc is the highest TM location
+   emitted so far. For use in conjunction with
+   emitSkip, emitBackup, and emitRestore */
 // 记录最高行号，用于emitRestore函数
-static int highEmitLoc = 0;
 
-/* Procedure emitComment prints a comment line 
- * with comment c in the code file
+/* opcode names as printed in the code file */
+static char * opCodeTab[]
+        = {"HALT","IN","OUT","ADD","SUB","MUL","DIV",
+           "LD","ST","LDA","LDC","JLT","JLE","JGT","JGE","JEQ","JNE"
+          };
+
+/* Function growSlots makes the code buffer hold
+ * at least location loc, marking new slots unused
+ */
+static void growSlots( Context * ctx, int loc )
+{ CodeBuf * b = ctx->codeBuf;
+  if (loc >= b->isize)
+  { int n = b->isize ? b->isize : 256;
+    int i;
+    while (loc >= n) n *= 2;
+    b->iMem = (Instruction *) realloc(b->iMem,n*sizeof(Instruction));
+    ctx->allocBytes += (n - b->isize)*sizeof(Instruction);
+    for (i=b->isize;i<n;i++) b->iMem[i].op = opNONE;
+    b->isize = n;
+  }
+}
+
+/* Procedure emitReset empties the code buffer
+ * and sets the code position back to location 0
+ */
+void emitReset( Context * ctx )
+{ int i;
+  if (ctx->codeBuf == NULL)
+    ctx->codeBuf = (CodeBuf *) calloc(1,sizeof(CodeBuf));
+  for (i=0;i<ctx->codeBuf->isize;i++)
+    ctx->codeBuf->iMem[i].op = opNONE;
+  ctx->codeBuf->ncomments = 0;
+  ctx->codeBuf->nsites = 0;
+  ctx->emitLoc = 0;
+  ctx->highEmitLoc = 0;
+}
+
+/* Procedure emitComment records a comment line 
+ * with comment c at the current code position
  */
 // 用于打印调试信息
-void emitComment( char * c )
-{ if (TraceCode) fprintf(code,"* %s\n",c);}
+void emitComment( Context * ctx, char * c )
+{ CodeBuf * b = ctx->codeBuf;
+  if (! TraceCode) return;
+  if (b->ncomments >= b->csize)
+  { int n = b->csize ? 2*b->csize : 256;
+    b->comments = (CodeComment *) realloc(b->comments,n*sizeof(CodeComment));
+    ctx->allocBytes += (n - b->csize)*sizeof(CodeComment);
+    b->csize = n;
+  }
+  b->comments[b->ncomments].loc = ctx->emitLoc;
+  b->comments[b->ncomments].seq = b->ncomments;
+  b->comments[b->ncomments].c = c;
+  b->ncomments++;
+}
+
+/* Procedure emitSite records that the jump
+ * emitted next is the test of profile site
+ * site, taken when the test is true if sense
+ * is TRUE
+ */
+void emitSite( Context * ctx, int site, int sense )
+{ CodeBuf * b = ctx->codeBuf;
+  if (site < 0) return;
+  if (b->nsites >= b->ssize)
+  { int n = b->ssize ? 2*b->ssize : 64;
+    b->sites = (CodeSite *) realloc(b->sites,n*sizeof(CodeSite));
+    ctx->allocBytes += (n - b->ssize)*sizeof(CodeSite);
+    b->ssize = n;
+  }
+  b->sites[b->nsites].loc = ctx->emitLoc;
+  b->sites[b->nsites].site = site;
+  b->sites[b->nsites].sense = sense;
+  b->nsites++;
+}
+
+/* Procedure emitInst stores one instruction at
+ * the current code position and advances it
+ */
+static void emitInst( Context * ctx, OpCode op,
+                      int r, int s, int t, int d, char * c)
+{ Instruction * i;
+  growSlots(ctx,ctx->emitLoc);
+  i = &ctx->codeBuf->iMem[ctx->emitLoc++];
+  i->op = op;
+  i->r = r;
+  i->s = s;
+  i->t = t;
+  i->d = d;
+  i->c = c;
+  if (ctx->highEmitLoc < ctx->emitLoc) ctx->highEmitLoc = ctx->emitLoc ;
+}
 
 /* Procedure emitRO emits a register-only
  * TM instruction
@@ -34,11 +120,8 @@ void emitComment( char * c )
  * t = 2nd source register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRO( char *op, int r, int s, int t, char *c)
-{ fprintf(code,"%3d:  %5s  %d,%d,%d ",emitLoc++,op,r,s,t);
-  if (TraceCode) fprintf(code,"\t%s",c) ;
-  fprintf(code,"\n") ;
-  if (highEmitLoc < emitLoc) highEmitLoc = emitLoc ;
+void emitRO( Context * ctx, OpCode op, int r, int s, int t, char *c)
+{ emitInst(ctx,op,r,s,t,0,c);
 } /* emitRO */
 
 /* Procedure emitRM emits a register-to-memory
@@ -49,11 +132,8 @@ void emitRO( char *op, int r, int s, int t, char *c)
  * s = the base register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRM( char * op, int r, int d, int s, char *c)
-{ fprintf(code,"%3d:  %5s  %d,%d(%d) ",emitLoc++,op,r,d,s);
-  if (TraceCode) fprintf(code,"\t%s",c) ;
-  fprintf(code,"\n") ;
-  if (highEmitLoc < emitLoc)  highEmitLoc = emitLoc ;
+void emitRM( Context * ctx, OpCode op, int r, int d, int s, char *c)
+{ emitInst(ctx,op,r,s,0,d,c);
 } /* emitRM */
 
 /* Function emitSkip skips "howMany" code
@@ -61,10 +141,10 @@ void emitRM( char * op, int r, int d, int s, char *c)
  * returns the current code position
  */
 // 留空
-int emitSkip( int howMany)
-{  int i = emitLoc;
-   emitLoc += howMany ;
-   if (highEmitLoc < emitLoc)  highEmitLoc = emitLoc ;
+int emitSkip( Context * ctx, int howMany)
+{  int i = ctx->emitLoc;
+   ctx->emitLoc += howMany ;
+   if (ctx->highEmitLoc < ctx->emitLoc)  ctx->highEmitLoc = ctx->emitLoc ;
    return i;
 } /* emitSkip */
 
@@ -72,9 +152,9 @@ int emitSkip( int howMany)
  * loc = a previously skipped location
  */
 // 回填
-void emitBackup( int loc)
-{ if (loc > highEmitLoc) emitComment("BUG in emitBackup");
-  emitLoc = loc ;
+void emitBackup( Context * ctx, int loc)
+{ if (loc > ctx->highEmitLoc) emitComment(ctx,"BUG in emitBackup");
+  ctx->emitLoc = loc ;
 } /* emitBackup */
 
 /* Procedure emitRestore restores the current 
@@ -82,8 +162,8 @@ void emitBackup( int loc)
  * unemitted position
  */
 // 回填后再回到当前位置
-void emitRestore(void)
-{ emitLoc = highEmitLoc;}
+void emitRestore( Context * ctx )
+{ ctx->emitLoc = ctx->highEmitLoc;}
 
 /* Procedure emitRM_Abs converts an absolute reference 
  * to a pc-relative reference when emitting a
@@ -94,11 +174,88 @@ void emitRestore(void)
  * c = a comment to be printed if TraceCode is TRUE
  */
 // 使用该函数的原因是：没有zero寄存器，只能迂回实现
-void emitRM_Abs( char *op, int r, int a, char * c)
-{ fprintf(code,"%3d:  %5s  %d,%d(%d) ",
-               emitLoc,op,r,a-(emitLoc+1),pc); // 绝对地址先转成相对地址，因为最终还是要和pc相加
-  ++emitLoc ;
-  if (TraceCode) fprintf(code,"\t%s",c) ;
-  fprintf(code,"\n") ;
-  if (highEmitLoc < emitLoc) highEmitLoc = emitLoc ;
+void emitRM_Abs( Context * ctx, OpCode op, int r, int a, char * c)
+{ emitInst(ctx,op,r,pc,0,a-(ctx->emitLoc+1),c); // 绝对地址先转成相对地址，因为最终还是要和pc相加
 } /* emitRM_Abs */
+
+/* comments are sorted by location; comments at
+ * the same location keep their emission order
+ */
+static int commentCmp( const void * a, const void * b )
+{ const CodeComment * x = (const CodeComment *) a;
+  const CodeComment * y = (const CodeComment *) b;
+  if (x->loc != y->loc) return x->loc - y->loc;
+  return x->seq - y->seq; /* qsort is not stable */
+}
+
+/* the text of the code file is assembled here */
+typedef struct
+   { char * text;
+     size_t len, size;
+   } TextBuf;
+
+/* Procedure textPrintf appends formatted text */
+static void textPrintf( TextBuf * tb, const char * fmt, ... )
+{ va_list args;
+  int n;
+  for (;;)
+  { va_start(args,fmt);
+    n = vsnprintf(tb->text+tb->len,tb->size-tb->len,fmt,args);
+    va_end(args);
+    if (tb->len + n < tb->size) break;
+    tb->size = 2*tb->size + n;
+    tb->text = (char *) realloc(tb->text,tb->size);
+  }
+  tb->len += n;
+}
+
+/* Procedure writeCode writes the buffered program
+ * to ctx->code in location order with a single
+ * write, comments preceding their instructions,
+ * followed by the locations of the profile sites
+ * as comments for tm -p
+ */
+void writeCode( Context * ctx )
+{ CodeBuf * b = ctx->codeBuf;
+  TextBuf tb;
+  int loc, k = 0;
+  tb.size = 64 + 48*ctx->highEmitLoc + 32*b->ncomments + 32*b->nsites;
+  tb.text = (char *) malloc(tb.size);
+  tb.len = 0;
+  if (b->ncomments > 0) /* comments is NULL when none were emitted */
+    qsort(b->comments,b->ncomments,sizeof(CodeComment),commentCmp);
+  for (loc=0;loc<=ctx->highEmitLoc;loc++)
+  { Instruction * i;
+    while ((k < b->ncomments) && (b->comments[k].loc <= loc))
+      textPrintf(&tb,"* %s\n",b->comments[k++].c);
+    if ((loc == ctx->highEmitLoc) || (loc >= b->isize)) continue;
+    i = &b->iMem[loc];
+    if (i->op == opNONE) continue;
+    if (isRO(i->op))
+      textPrintf(&tb,"%3d:  %5s  %d,%d,%d ",loc,opCodeTab[i->op],i->r,i->s,i->t);
+    else
+      textPrintf(&tb,"%3d:  %5s  %d,%d(%d) ",loc,opCodeTab[i->op],i->r,i->d,i->s);
+    if (TraceCode) textPrintf(&tb,"\t%s",i->c) ;
+    textPrintf(&tb,"\n") ;
+  }
+  while (k < b->ncomments) // 超出最高地址的注释（不应出现）
+    textPrintf(&tb,"* %s\n",b->comments[k++].c);
+  // 站点表总是写出（tm只认注释行），即使没有剖析也不影响运行
+  textPrintf(&tb,"* sites %d\n",ctx->nsites);
+  for (k=0;k<b->nsites;k++)
+    if (b->sites[k].loc >= 0)
+      textPrintf(&tb,"* site %d %d %c\n",b->sites[k].site,b->sites[k].loc,
+                 b->sites[k].sense ? 't' : 'f');
+  fwrite(tb.text,1,tb.len,ctx->code);
+  free(tb.text);
+} /* writeCode */
+
+/* Procedure freeCode releases the code buffer */
+void freeCode( Context * ctx )
+{ if (ctx->codeBuf == NULL) return;
+  free(ctx->codeBuf->iMem);
+  free(ctx->codeBuf->comments);
+  free(ctx->codeBuf->sites);
+  free(ctx->codeBuf);
+  ctx->codeBuf = NULL;
+}
@@ -11,7 +11,7 @@
 
 // 5/6/7号寄存器有特殊用意
 // 0/1号寄存器做计算用
-// 剩下三个寄存器不用
+// 2/3/4号寄存器存放表达式的中间值
 
 /* pc = program counter  */
 #define  pc 7
@@ -33,12 +33,95 @@
 /* 2nd accumulator */
 #define  ac1 1
 
-/* code emitting utilities */
+/* registers tmpFirst..tmpLast hold the
+ * temporaries of expression evaluation
+ */
+#define  tmpFirst 2
+#define  tmpLast 4
+
+/* TM opcodes, in the same order as in tm.c */
+typedef enum {
+   /* RO instructions */
+   opHALT,opIN,opOUT,opADD,opSUB,opMUL,opDIV,
+   /* RM instructions */
+   opLD,opST,opLDA,opLDC,
+   opJLT,opJLE,opJGT,opJGE,opJEQ,opJNE,
+   /* a location skipped but never backpatched */
+   opNONE
+   } OpCode;
+
+/* isRO is TRUE for register-only opcodes */
+#define isRO(op) ((op) <= opDIV)
+
+/* one buffered TM instruction:
+ * RO form: op r,s,t
+ * RM form: op r,d(s)
+ * c = comment printed if TraceCode is TRUE
+ */
+typedef struct
+   { OpCode op;
+     int r, s, t, d;
+     char * c;
+   } Instruction;
+
+/* a comment line that precedes the
+ * instruction at location loc
+ */
+typedef struct
+   { int loc;
+     int seq; /* emission order, for comments at the same loc */
+     char * c;
+   } CodeComment;
+
+/* the conditional jump at location loc is the
+ * test of profile site (profile.h); it is taken
+ * when the test is true if sense is TRUE
+ */
+typedef struct
+   { int loc;
+     int site;
+     int sense;
+   } CodeSite;
+
+/* the TM program being generated; instructions
+ * are indexed by code location, so a backpatch
+ * is simply a store into iMem
+ */
+// 代码先缓存在内存中，最后按地址顺序一次写出，
+// 回填不再需要把指令打印到文件的乱序位置上
+typedef struct codeBufRec
+   { Instruction * iMem;
+     int isize; /* allocated instruction slots */
+     CodeComment * comments;
+     int ncomments;
+     int csize; /* allocated comment slots */
+     CodeSite * sites;
+     int nsites;
+     int ssize; /* allocated site slots */
+   } CodeBuf;
+
+/* code emitting utilities; the current code
+ * position and the buffered program are kept
+ * in the compilation context. Comment strings
+ * must remain valid until writeCode is called
+ */
 
-/* Procedure emitComment prints a comment line 
- * with comment c in the code file
+/* Procedure emitReset empties the code buffer
+ * and sets the code position back to location 0
  */
-void emitComment( char * c );
+void emitReset( Context * ctx );
+
+/* Procedure emitComment records a comment line
+ * with comment c at the current code position
+ */
+void emitComment( Context * ctx, char * c );
+
+/* Procedure emitSite records that the jump
+ * emitted next is the test of profile site
+ * site, taken when the test is true if sense
+ * is TRUE. Nothing is recorded for site -1
+ */
+void emitSite( Context * ctx, int site, int sense );
 
 /* Procedure emitRO emits a register-only
  * TM instruction
@@ -48,7 +131,7 @@ void emitComment( char * c );
  * t = 2nd source register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRO( char *op, int r, int s, int t, char *c);
+void emitRO( Context * ctx, OpCode op, int r, int s, int t, char *c);
 
 /* Procedure emitRM emits a register-to-memory
  * TM instruction
@@ -58,24 +141,24 @@ void emitRO( char *op, int r, int s, int t, char *c);
  * s = the base register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRM( char * op, int r, int d, int s, char *c);
+void emitRM( Context * ctx, OpCode op, int r, int d, int s, char *c);
 
 /* Function emitSkip skips "howMany" code
  * locations for later backpatch. It also
  * returns the current code position
  */
-int emitSkip( int howMany);
+int emitSkip( Context * ctx, int howMany);
 
 /* Procedure emitBackup backs up to 
  * loc = a previously skipped location
  */
-void emitBackup( int loc);
+void emitBackup( Context * ctx, int loc);
 
 /* Procedure emitRestore restores the current 
  * code position to the highest previously
  * unemitted position
  */
-void emitRestore(void);
+void emitRestore( Context * ctx );
 
 /* Procedure emitRM_Abs converts an absolute reference 
  * to a pc-relative reference when emitting a
@@ -85,6 +168,17 @@ void emitRestore(void);
  * a = the absolute location in memory
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRM_Abs( char *op, int r, int a, char * c);
+void emitRM_Abs( Context * ctx, OpCode op, int r, int a, char * c);
+
+/* Procedure writeCode writes the buffered program
+ * to ctx->code in location order with a single
+ * write, comments preceding their instructions,
+ * followed by the locations of the profile sites
+ * as comments for tm -p
+ */
+void writeCode( Context * ctx );
+
+/* Procedure freeCode releases the code buffer */
+void freeCode( Context * ctx );
 
 #endif
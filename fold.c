@@ -0,0 +1,203 @@
+/****************************************************/
+/* File: fold.c                                     */
+/* Constant folding and algebraic simplification    */
+/* of the syntax tree for the TINY compiler         */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "util.h"
+#include "fold.h"
+#include <limits.h>
+
+// 折叠必须和TM运行时的结果完全一致：
+// 加减乘按32位补码回绕，比较a<b在TM上是SUB后JLT，即(a-b)<0，
+// 除以0要留到运行时由tm报错，INT_MIN/-1在tm中会触发SIGFPE，同样不折叠
+
+/* Function isConst returns TRUE if t is
+ * the integer constant v
+ */
+static int isConst( TreeNode * t, int v )
+{ return (t->kind.exp == ConstK) && (t->attr.val == v); }
+
+/* Function mayTrap returns TRUE if evaluating
+ * expression t may stop the TM machine, that is,
+ * if it contains a division that is not by a
+ * constant other than 0 and -1
+ */
+int mayTrap( TreeNode * t )
+{ if (t->kind.exp != OpK) return FALSE;
+  if ((t->attr.op == OVER) &&
+      ((t->child[1]->kind.exp != ConstK) ||
+       (t->child[1]->attr.val == 0) || (t->child[1]->attr.val == -1)))
+    return TRUE;
+  return mayTrap(t->child[0]) || mayTrap(t->child[1]);
+}
+
+/* Function sameExp returns TRUE if expressions
+ * a and b always have the same value
+ */
+static int sameExp( TreeNode * a, TreeNode * b )
+{ if (a->kind.exp != b->kind.exp) return FALSE;
+  switch (a->kind.exp)
+  { case ConstK: return a->attr.val == b->attr.val;
+    case IdK: return a->symbol == b->symbol;
+    case OpK:
+      return (a->attr.op == b->attr.op) &&
+             sameExp(a->child[0],b->child[0]) &&
+             sameExp(a->child[1],b->child[1]);
+    default: return FALSE;
+  }
+}
+
+/* Function evalOp computes a op b as the TM
+ * machine does; a division by 0 or of INT_MIN
+ * by -1 must not reach here
+ */
+int evalOp( TokenType op, int a, int b )
+{ switch (op)
+  { case PLUS: return (int) ((unsigned) a + (unsigned) b);
+    case MINUS: return (int) ((unsigned) a - (unsigned) b);
+    case TIMES: return (int) ((unsigned) a * (unsigned) b);
+    case OVER: return a / b;
+    case LT: return (int) ((unsigned) a - (unsigned) b) < 0;
+    case EQ: return a == b;
+    default: return 0;
+  }
+}
+
+/* Function makeConst turns expression node t
+ * into the constant v, freeing its operands
+ */
+static TreeNode * makeConst( TreeNode * t, int v )
+{ int i;
+  for (i=0;i<MAXCHILDREN;i++)
+  { freeTree(t->child[i]);
+    t->child[i] = NULL;
+  }
+  t->kind.exp = ConstK;
+  t->attr.val = v; // type不变：Integer或Boolean
+  return t;
+}
+
+/* Function keepChild returns child i of t,
+ * freeing t and its other children
+ */
+static TreeNode * keepChild( TreeNode * t, int i )
+{ TreeNode * c = t->child[i];
+  t->child[i] = NULL;
+  freeTree(t);
+  return c;
+}
+
+/* Function foldExp simplifies expression t
+ * bottom up and returns the new expression
+ */
+static TreeNode * foldExp( Context * ctx, TreeNode * t )
+{ TreeNode * l, * r;
+  if ((t == NULL) || (t->kind.exp != OpK)) return t;
+  l = t->child[0] = foldExp(ctx,t->child[0]);
+  r = t->child[1] = foldExp(ctx,t->child[1]);
+  if ((l->kind.exp == ConstK) && (r->kind.exp == ConstK))
+  { if ((t->attr.op == OVER) &&
+        ((r->attr.val == 0) || ((r->attr.val == -1) && (l->attr.val == INT_MIN))))
+      return t; /* leave it to trap at run time */
+    return makeConst(t,evalOp(t->attr.op,l->attr.val,r->attr.val));
+  }
+  switch (t->attr.op)
+  { case PLUS:
+    case MINUS:
+      if (isConst(r,0)) return keepChild(t,0);
+      if ((t->attr.op == PLUS) && isConst(l,0)) return keepChild(t,1);
+      if ((t->attr.op == MINUS) && sameExp(l,r) && !mayTrap(l))
+        return makeConst(t,0);
+      /* (e+c1)+c2 = e+(c1+c2) etc., since TM addition wraps */
+      // 模板生成的代码常有x+1+2这类链，合并成一个常数
+      if ((r->kind.exp == ConstK) && (l->kind.exp == OpK) &&
+          ((l->attr.op == PLUS) || (l->attr.op == MINUS)) &&
+          (l->child[1]->kind.exp == ConstK))
+      { int c = l->attr.op == PLUS ? l->child[1]->attr.val
+                                   : evalOp(MINUS,0,l->child[1]->attr.val);
+        c = evalOp(t->attr.op,c,r->attr.val);
+        t->attr.op = PLUS;
+        t->child[0] = keepChild(l,0);
+        makeConst(r,c);
+        if (c == 0) return keepChild(t,0);
+      }
+      break;
+    case TIMES:
+      if (isConst(r,1)) return keepChild(t,0);
+      if (isConst(l,1)) return keepChild(t,1);
+      if ((isConst(r,0) && !mayTrap(l)) || (isConst(l,0) && !mayTrap(r)))
+        return makeConst(t,0);
+      /* (e*c1)*c2 = e*(c1*c2) */
+      if ((r->kind.exp == ConstK) && (l->kind.exp == OpK) &&
+          (l->attr.op == TIMES) && (l->child[1]->kind.exp == ConstK))
+      { makeConst(r,evalOp(TIMES,l->child[1]->attr.val,r->attr.val));
+        t->child[0] = keepChild(l,0);
+        if (isConst(r,1)) return keepChild(t,0);
+        if (isConst(r,0) && !mayTrap(t->child[0])) return makeConst(t,0);
+      }
+      break;
+    case OVER:
+      if (isConst(r,1)) return keepChild(t,0);
+      break;
+    case LT:
+      if (sameExp(l,r) && !mayTrap(l)) return makeConst(t,0);
+      break;
+    case EQ:
+      if (sameExp(l,r) && !mayTrap(l)) return makeConst(t,1);
+      break;
+    default:
+      break;
+  }
+  return t;
+}
+
+/* Function foldStmts simplifies the statement
+ * sequence t and returns the new sequence; if
+ * and repeat statements whose test is constant
+ * are replaced by the statements that run
+ */
+static TreeNode * foldStmts( Context * ctx, TreeNode * t )
+{ TreeNode * head = NULL;
+  TreeNode ** tail = &head;
+  while (t != NULL) // 兄弟结点循环处理
+  { TreeNode * next = t->sibling;
+    TreeNode * s = t; /* what t is replaced by */
+    t->sibling = NULL;
+    switch (t->kind.stmt)
+    { case IfK:
+        t->child[0] = foldExp(ctx,t->child[0]);
+        t->child[1] = foldStmts(ctx,t->child[1]);
+        t->child[2] = foldStmts(ctx,t->child[2]);
+        if (t->child[0]->kind.exp == ConstK) // 只保留会执行的分支
+          s = keepChild(t,t->child[0]->attr.val != 0 ? 1 : 2);
+        break;
+      case RepeatK:
+        t->child[0] = foldStmts(ctx,t->child[0]);
+        t->child[1] = foldExp(ctx,t->child[1]);
+        if ((t->child[1]->kind.exp == ConstK) && (t->child[1]->attr.val != 0))
+          s = keepChild(t,0); /* the body runs exactly once */
+        break;
+      case AssignK:
+      case WriteK:
+        t->child[0] = foldExp(ctx,t->child[0]);
+        break;
+      default:
+        break;
+    }
+    *tail = s;
+    while (*tail != NULL) tail = &(*tail)->sibling;
+    t = next;
+  }
+  return head;
+}
+
+/* Function foldTree folds constant subexpressions,
+ * applies algebraic identities and removes if and
+ * repeat statements with constant tests in the
+ * type checked syntax tree
+ */
+TreeNode * foldTree( Context * ctx, TreeNode * syntaxTree )
+{ return foldStmts(ctx,syntaxTree); }
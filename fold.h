@@ -0,0 +1,33 @@
+/****************************************************/
+/* File: fold.h                                     */
+/* Constant folding and algebraic simplification    */
+/* of the syntax tree for the TINY compiler         */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _FOLD_H_
+#define _FOLD_H_
+
+/* Function foldTree folds constant subexpressions,
+ * applies algebraic identities and removes if and
+ * repeat statements with constant tests in the
+ * type checked syntax tree. It returns the new tree;
+ * nodes no longer needed are freed
+ */
+TreeNode * foldTree(Context * ctx, TreeNode * syntaxTree);
+
+/* Function mayTrap returns TRUE if evaluating
+ * expression t may stop the TM machine, that is,
+ * if it contains a division that is not by a
+ * constant other than 0 and -1
+ */
+int mayTrap(TreeNode * t);
+
+/* Function evalOp computes a op b as the TM
+ * machine does (LT and EQ give 1 or 0); a
+ * division by 0 or of INT_MIN by -1 must not
+ * reach here
+ */
+int evalOp(TokenType op, int a, int b);
+
+#endif
@@ -41,12 +41,6 @@ typedef enum
     ASSIGN,EQ,LT,PLUS,MINUS,TIMES,OVER,LPAREN,RPAREN,SEMI
    } TokenType;
 
-extern FILE* source; /* source code text file */
-extern FILE* listing; /* listing output text file */
-extern FILE* code; /* code text file for TM simulator */
-
-extern int lineno; /* source line number for listing */
-
 /**************************************************/
 /***********   Syntax tree for parsing ************/
 /**************************************************/
@@ -71,6 +65,9 @@ typedef struct treeNode
              int val;
              char * name; } attr;
      ExpType type; /* for type checking of exps */
+     int symbol; /* symbol table handle of attr.name, -1 if none */
+     int site; /* profile site of an if or repeat, -1 if none */
+     int need; /* temporaries needed to evaluate an exp (cgen.c) */
    } TreeNode;
 
 /**************************************************/
@@ -105,6 +102,91 @@ extern int TraceAnalyze;
  */
 extern int TraceCode;
 
-/* Error = TRUE prevents further passes if an error occurs */
-extern int Error; 
+/* TraceIR = TRUE causes the intermediate code
+ * to be printed to the listing file (at -O2)
+ */
+extern int TraceIR;
+
+/**************************************************/
+/***********   Optimization level      ************/
+/**************************************************/
+
+/* OptLevel selects the optimizations performed
+ * (-O<n>): 0 = none, 1 = constant folding, dead
+ * store elimination and peephole optimization
+ * (the default), 2 = also generate code through
+ * the SSA IR (ir.h)
+ */
+extern int OptLevel;
+
+/* UnrollFactor is the number of copies of the body
+ * of a counted repeat loop that is unrolled
+ * (-funroll=<n>, at -O1 and above); 1 unrolls only
+ * loops that run a few times, replacing them by
+ * copies of their body
+ */
+extern int UnrollFactor;
+
+/* EvalBudget is the number of steps allowed for
+ * running the part of the program before its
+ * first read at compile time (-feval-budget=<n>,
+ * at -O1 and above); 0 turns it off
+ */
+extern long EvalBudget;
+
+/**************************************************/
+/***********   Compilation context     ************/
+/**************************************************/
+// 一次编译的全部状态都集中在这里，每个阶段都通过参数拿到它，
+// 因此多个编译可以在不同线程中同时进行
+
+/* MAXTOKENLEN is the maximum size of a token */
+#define MAXTOKENLEN 40
+
+/* BUFLEN = length of the input buffer for
+   source code lines */
+#define BUFLEN 256
+
+typedef struct contextRec
+   { FILE * source; /* source code text file */
+     FILE * listing; /* listing output text file */
+     FILE * code; /* code text file for TM simulator */
+     int lineno; /* source line number for listing */
+     /* Error = TRUE prevents further passes if an error occurs */
+     int Error;
+     /* scanner state (scan.c) */
+     char tokenString[MAXTOKENLEN+1]; /* lexeme of identifier or reserved word */
+     char lineBuf[BUFLEN]; /* holds the current line */
+     int linepos; /* current position in LineBuf */
+     int bufsize; /* current size of buffer string */
+     int EOF_flag; /* corrects ungetNextChar behavior on EOF */
+     int inComment; /* the scan stopped at the end of file in a comment */
+     struct scanPipeRec * pipe; /* NULL unless scanning on its own thread */
+     struct lexedRec * lexed; /* NULL unless lexed in parallel */
+     /* parser state (parse.c) */
+     TokenType token; /* holds current token */
+     /* symbol table (symtab.c) */
+     struct symTableRec * symtab;
+     /* semantic analyzer state (analyze.c) */
+     int location; /* counter for variable memory locations */
+     /* code generator state (cgen.c) */
+     int tmpOffset; /* memory offset for temps */
+     int tmpReg; /* next free temporary register */
+     int tmpTop; /* last register left for temporaries */
+     int * varReg; /* register holding each variable, 0 if none */
+     /* code emitter state (code.c) */
+     int emitLoc; /* TM location number for current instruction emission */
+     int highEmitLoc; /* highest TM location emitted so far */
+     struct codeBufRec * codeBuf; /* the buffered TM program */
+     /* printTree state (util.c) */
+     int indentno; /* current number of spaces to indent */
+     /* sizes and allocation counters for the time report */
+     int ntokens; /* tokens returned by getToken */
+     int nnodes; /* syntax tree nodes allocated */
+     long allocBytes; /* bytes allocated through util.c */
+     struct timeReportRec * report; /* NULL unless reporting (report.c) */
+     /* execution profile (profile.c) */
+     int nsites; /* number of if and repeat statements */
+     struct profileRec * profile; /* NULL unless compiling with a profile */
+   } Context;
 #endif
@@ -0,0 +1,276 @@
+/****************************************************/
+/* File: interp.c                                   */
+/* Register bytecode interpreter for running TINY  */
+/* programs without the TM simulator (--run)        */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "interp.h"
+#include <limits.h>
+
+// 每个变量固定占一个寄存器（下标就是符号表句柄），表达式的临时值按栈的方式
+// 分配在变量之后，所以不需要LD/ST；if和repeat的比较和条件跳转合成一条指令
+
+/* the bytecode operations; a, b and c are
+ * registers unless noted
+ */
+typedef enum
+   { bcHalt,
+     bcConst, /* reg(a) = b */
+     bcMove, /* reg(a) = reg(b) */
+     bcAdd,bcSub,bcMul,bcDiv, /* reg(a) = reg(b) op reg(c) */
+     bcLt,bcEq, /* reg(a) = reg(b) op reg(c) ? 1 : 0 */
+     bcIn, /* reg(a) = next input value */
+     bcOut, /* write reg(a) */
+     bcJmp, /* jump to a */
+     bcJz,bcJnz, /* jump to c if reg(a) is (not) 0 */
+     bcJlt,bcJge,bcJeq,bcJne /* jump to c if reg(a) op reg(b) */
+   } BcOp;
+
+typedef struct
+   { BcOp op;
+     int a, b, c;
+   } BcInst;
+
+typedef struct bytecodeRec
+   { BcInst * code;
+     int ncode; /* instructions used */
+     int csize; /* instructions allocated */
+     int nregs; /* variables and temporaries */
+     Context * ctx;
+   } Program;
+
+/* Function emit appends an instruction to bc and
+ * returns its location
+ */
+static int emit( Program * bc, BcOp op, int a, int b, int c )
+{ BcInst * i;
+  if (bc->ncode == bc->csize)
+  { bc->csize = bc->csize ? 2*bc->csize : 64;
+    bc->code = (BcInst *) realloc(bc->code,bc->csize*sizeof(BcInst));
+    bc->ctx->allocBytes += bc->csize/2*sizeof(BcInst);
+  }
+  i = &bc->code[bc->ncode];
+  i->op = op;
+  i->a = a;
+  i->b = b;
+  i->c = c;
+  return bc->ncode++;
+}
+
+/* Function useReg notes that register r is used
+ * and returns it
+ */
+static int useReg( Program * bc, int r )
+{ if (r >= bc->nregs) bc->nregs = r+1;
+  return r;
+}
+
+/* Function lowerExp lowers expression t, leaving
+ * its value in register dest, or in any register
+ * if dest is -1; tmp is the first free temporary.
+ * It returns the register holding the value
+ */
+static int lowerExp( Program * bc, TreeNode * t, int dest, int tmp )
+{ int l, r, d = useReg(bc,(dest < 0) ? tmp : dest);
+  switch (t->kind.exp)
+  { case IdK:
+      if (dest < 0) return t->symbol;
+      emit(bc,bcMove,d,t->symbol,0);
+      return d;
+    case ConstK:
+      emit(bc,bcConst,d,t->attr.val,0);
+      return d;
+    default: /* only the root writes dest, after the operands are read */
+      l = lowerExp(bc,t->child[0],-1,tmp);
+      r = lowerExp(bc,t->child[1],-1,(l == tmp) ? tmp+1 : tmp);
+      switch (t->attr.op)
+      { case PLUS: emit(bc,bcAdd,d,l,r); break;
+        case MINUS: emit(bc,bcSub,d,l,r); break;
+        case TIMES: emit(bc,bcMul,d,l,r); break;
+        case OVER: emit(bc,bcDiv,d,l,r); break;
+        case LT: emit(bc,bcLt,d,l,r); break;
+        default: emit(bc,bcEq,d,l,r); break;
+      }
+      return d;
+  }
+}
+
+/* Function lowerTest lowers test t to a jump
+ * taken if its value is sense; the target is
+ * patched later. It returns the location of the
+ * jump
+ */
+static int lowerTest( Program * bc, TreeNode * t, int sense, int tmp )
+{ int l, r;
+  if ((t->kind.exp == OpK) && ((t->attr.op == LT) || (t->attr.op == EQ)))
+  { l = lowerExp(bc,t->child[0],-1,tmp);
+    r = lowerExp(bc,t->child[1],-1,(l == tmp) ? tmp+1 : tmp);
+    if (t->attr.op == LT) return emit(bc,sense ? bcJlt : bcJge,l,r,0);
+    return emit(bc,sense ? bcJeq : bcJne,l,r,0);
+  }
+  l = lowerExp(bc,t,-1,tmp);
+  return emit(bc,sense ? bcJnz : bcJz,l,0,0);
+}
+
+/* Procedure lowerStmts lowers the statement
+ * sequence t; tmp is the first temporary
+ */
+static void lowerStmts( Program * bc, TreeNode * t, int tmp )
+{ int jump, skip, top;
+  for (;t != NULL;t=t->sibling)
+    switch (t->kind.stmt)
+    { case IfK:
+        jump = lowerTest(bc,t->child[0],FALSE,tmp);
+        lowerStmts(bc,t->child[1],tmp);
+        if (t->child[2] != NULL)
+        { skip = emit(bc,bcJmp,0,0,0);
+          bc->code[jump].c = bc->ncode;
+          lowerStmts(bc,t->child[2],tmp);
+          bc->code[skip].a = bc->ncode;
+        }
+        else bc->code[jump].c = bc->ncode;
+        break;
+      case RepeatK:
+        top = bc->ncode;
+        lowerStmts(bc,t->child[0],tmp);
+        jump = lowerTest(bc,t->child[1],FALSE,tmp);
+        bc->code[jump].c = top;
+        break;
+      case AssignK:
+        lowerExp(bc,t->child[0],t->symbol,tmp);
+        break;
+      case ReadK:
+        emit(bc,bcIn,t->symbol,0,0);
+        break;
+      case WriteK:
+        emit(bc,bcOut,lowerExp(bc,t->child[0],-1,tmp),0,0);
+        break;
+      default:
+        break;
+    }
+}
+
+Bytecode lowerProgram( Context * ctx, TreeNode * syntaxTree )
+{ Program * bc = (Program *) calloc(1,sizeof(Program));
+  ctx->allocBytes += sizeof(Program);
+  bc->ctx = ctx;
+  bc->nregs = ctx->location; /* one register per variable */
+  lowerStmts(bc,syntaxTree,ctx->location);
+  emit(bc,bcHalt,0,0,0);
+  return bc;
+}
+
+/* LINESIZE = the longest input line */
+#define LINESIZE 121
+
+/* Function readNum reads a value from line as the
+ * TM simulator does: a term is a number with any
+ * signs before it, and terms separated by + or -
+ * are added up. It returns FALSE if the line does
+ * not end in a number
+ */
+static int readNum( char * line, int * num )
+{ int sign, ok = FALSE;
+  unsigned term, sum = 0;
+  do
+  { sign = 1;
+    while (*line == ' ') line++;
+    while ((*line == '+') || (*line == '-'))
+    { ok = FALSE;
+      if (*line == '-') sign = -sign;
+      line++;
+      while (*line == ' ') line++;
+    }
+    term = 0;
+    while (isdigit(*line))
+    { ok = TRUE;
+      term = term*10 + (*line - '0');
+      line++;
+    }
+    sum += (sign < 0) ? 0u - term : term;
+    while (*line == ' ') line++;
+  } while ((*line == '+') || (*line == '-'));
+  *num = (int) sum;
+  return ok;
+}
+
+// 主循环：加减乘按32位回绕；INT_MIN/-1在tm中会使模拟器本身崩溃，这里取回绕的结果
+int runBytecode( Bytecode bc, FILE * in, FILE * out )
+{ int * reg = (int *) calloc(bc->nregs+1,sizeof(int));
+  BcInst * code = bc->code;
+  BcInst * pc = code;
+  char line[LINESIZE+1];
+  int ok = FALSE;
+  for (;;)
+  { BcInst * i = pc++;
+    switch (i->op)
+    { case bcConst: reg[i->a] = i->b; break;
+      case bcMove: reg[i->a] = reg[i->b]; break;
+      case bcAdd:
+        reg[i->a] = (int) ((unsigned) reg[i->b] + (unsigned) reg[i->c]);
+        break;
+      case bcSub:
+        reg[i->a] = (int) ((unsigned) reg[i->b] - (unsigned) reg[i->c]);
+        break;
+      case bcMul:
+        reg[i->a] = (int) ((unsigned) reg[i->b] * (unsigned) reg[i->c]);
+        break;
+      case bcDiv:
+        if (reg[i->c] == 0)
+        { fprintf(out,"Division by 0\n");
+          goto done;
+        }
+        if ((reg[i->c] == -1) && (reg[i->b] == INT_MIN)) reg[i->a] = INT_MIN;
+        else reg[i->a] = reg[i->b] / reg[i->c];
+        break;
+      case bcLt: /* TM compares by subtracting */
+        reg[i->a] = (int) ((unsigned) reg[i->b] - (unsigned) reg[i->c]) < 0;
+        break;
+      case bcEq: reg[i->a] = reg[i->b] == reg[i->c]; break;
+      case bcIn:
+        for (;;)
+        { fprintf(out,"Enter value for IN instruction: ");
+          fflush(out);
+          if (fgets(line,sizeof(line),in) == NULL)
+          { fprintf(out,"\nEnd of input\n");
+            goto done;
+          }
+          line[strcspn(line,"\r\n")] = '\0';
+          if (readNum(line,&reg[i->a])) break;
+          fprintf(out,"Illegal value\n");
+        }
+        break;
+      case bcOut:
+        fprintf(out,"OUT instruction prints: %d\n",reg[i->a]);
+        break;
+      case bcJmp: pc = code + i->a; break;
+      case bcJz: if (reg[i->a] == 0) pc = code + i->c; break;
+      case bcJnz: if (reg[i->a] != 0) pc = code + i->c; break;
+      case bcJlt:
+        if ((int) ((unsigned) reg[i->a] - (unsigned) reg[i->b]) < 0)
+          pc = code + i->c;
+        break;
+      case bcJge:
+        if ((int) ((unsigned) reg[i->a] - (unsigned) reg[i->b]) >= 0)
+          pc = code + i->c;
+        break;
+      case bcJeq: if (reg[i->a] == reg[i->b]) pc = code + i->c; break;
+      case bcJne: if (reg[i->a] != reg[i->b]) pc = code + i->c; break;
+      default: /* halt */
+        fprintf(out,"Halted\n");
+        ok = TRUE;
+        goto done;
+    }
+  }
+done:
+  fflush(out);
+  free(reg);
+  return ok;
+}
+
+void freeBytecode( Bytecode bc )
+{ free(bc->code);
+  free(bc);
+}
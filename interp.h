@@ -0,0 +1,36 @@
+/****************************************************/
+/* File: interp.h                                   */
+/* Register bytecode interpreter for running TINY  */
+/* programs without the TM simulator (--run)        */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _INTERP_H_
+#define _INTERP_H_
+
+/* Bytecode is a handle to a program lowered to
+ * register bytecode: each variable has its own
+ * register, expression temporaries are allocated
+ * above them
+ */
+typedef struct bytecodeRec * Bytecode;
+
+/* Function lowerProgram lowers the type checked
+ * syntax tree to bytecode
+ */
+Bytecode lowerProgram(Context * ctx, TreeNode * syntaxTree);
+
+/* Function runBytecode runs program bc with the
+ * integer arithmetic and the input and output of
+ * the TM simulator: each read prompts on out for a
+ * line of in, each write prints an OUT line, and
+ * the run ends with "Halted" or "Division by 0".
+ * It returns FALSE if the program did not halt
+ * normally
+ */
+int runBytecode(Bytecode bc, FILE * in, FILE * out);
+
+/* Procedure freeBytecode releases program bc */
+void freeBytecode(Bytecode bc);
+
+#endif
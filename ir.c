@@ -0,0 +1,569 @@
+/****************************************************/
+/* File: ir.c                                       */
+/* SSA intermediate representation for the         */
+/* TINY compiler: construction from the syntax      */
+/* tree, numbering and dump                         */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+#include "profile.h"
+
+// SSA的构造在翻译语法树的同时进行（Braun等人的算法）：
+// 每个块记录变量的当前定义，块内找不到就到前驱中找，
+// 多个前驱时建phi；前驱还不全的块（repeat的循环头）先建不完整的phi，
+// 等块封闭(seal)后再补上操作数
+
+/* the current definition of each variable in
+ * each block, hashed on (block, variable)
+ */
+typedef struct defTabRec
+   { long * key; /* block*nvars+var+1, 0 = empty */
+     IrInst ** val;
+     int size, count;
+   } DefTab;
+
+/* Function defSlot returns the slot of key k */
+static int defSlot( DefTab * d, long k )
+{ unsigned i = (unsigned) (k * 2654435761u) & (d->size - 1);
+  while ((d->key[i] != 0) && (d->key[i] != k))
+    i = (i + 1) & (d->size - 1);
+  return i;
+}
+
+/* Procedure writeVar records v as the current
+ * definition of variable var in block blk
+ */
+static void writeVar( IrProg * ir, int var, IrBlock * blk, IrInst * v )
+{ DefTab * d = ir->defs;
+  long k = (long) blk->id * ir->nvars + var + 1;
+  int i;
+  if (2*(d->count+1) > d->size) // 装填因子超过1/2时扩容
+  { long * oldKey = d->key;
+    IrInst ** oldVal = d->val;
+    int j, oldSize = d->size;
+    d->size = oldSize ? 2*oldSize : 64;
+    d->key = (long *) calloc(d->size,sizeof(long));
+    d->val = (IrInst **) malloc(d->size*sizeof(IrInst *));
+    for (j=0;j<oldSize;j++)
+      if (oldKey[j] != 0)
+      { i = defSlot(d,oldKey[j]);
+        d->key[i] = oldKey[j];
+        d->val[i] = oldVal[j];
+      }
+    free(oldKey);
+    free(oldVal);
+  }
+  i = defSlot(d,k);
+  if (d->key[i] == 0)
+  { d->key[i] = k;
+    d->count++;
+  }
+  d->val[i] = v;
+}
+
+/* Function resolve returns the value that
+ * replaces v (v itself unless v was a
+ * removed phi)
+ */
+static IrInst * resolve( IrInst * v )
+{ while ((v != NULL) && (v->forward != NULL)) v = v->forward;
+  return v;
+}
+
+IrInst * irNewInst( IrProg * ir, IrBlock * blk, IrInst * before,
+                    IrOp op, IrInst * a, IrInst * b )
+{ IrInst * i = (IrInst *) calloc(1,sizeof(IrInst));
+  ir->ctx->allocBytes += sizeof(IrInst);
+  i->op = op;
+  i->id = ir->nvalues++;
+  i->arg[0] = a;
+  i->arg[1] = b;
+  i->allNext = ir->all;
+  ir->all = i;
+  irInsert(i,blk,before);
+  return i;
+}
+
+void irInsert( IrInst * i, IrBlock * blk, IrInst * before )
+{ i->block = blk;
+  i->next = before;
+  i->prev = (before != NULL) ? before->prev : blk->last;
+  if (i->prev != NULL) i->prev->next = i; else blk->first = i;
+  if (before != NULL) before->prev = i; else blk->last = i;
+}
+
+void irRemove( IrInst * i )
+{ IrBlock * blk = i->block;
+  if (i->prev != NULL) i->prev->next = i->next; else blk->first = i->next;
+  if (i->next != NULL) i->next->prev = i->prev; else blk->last = i->prev;
+  i->prev = i->next = NULL;
+}
+
+/* Function zero returns the constant 0, which
+ * is the value of a variable never assigned
+ * (TM memory starts cleared)
+ */
+static IrInst * zero( IrProg * ir )
+{ if (ir->zero == NULL)
+  { IrBlock * entry = ir->block[0];
+    ir->zero = irNewInst(ir,entry,entry->first,IrConst,NULL,NULL);
+    ir->zero->val = 0;
+  }
+  return ir->zero;
+}
+
+/* Function makeBlock creates a new empty block
+ * with the given loop depth, not yet placed in
+ * the program
+ */
+static IrBlock * makeBlock( IrProg * ir, int depth )
+{ IrBlock * blk = (IrBlock *) calloc(1,sizeof(IrBlock));
+  ir->ctx->allocBytes += sizeof(IrBlock);
+  blk->id = -1;
+  blk->term = IrHalt;
+  blk->site = -1;
+  blk->depth = depth;
+  blk->sealed = TRUE;
+  return blk;
+}
+
+/* Procedure placeBlock appends block blk to the
+ * program
+ */
+static void placeBlock( IrProg * ir, IrBlock * blk )
+{ if (ir->nblocks >= ir->bsize)
+  { ir->bsize = ir->bsize ? 2*ir->bsize : 16;
+    ir->block = (IrBlock **) realloc(ir->block,ir->bsize*sizeof(IrBlock *));
+  }
+  blk->id = ir->nblocks;
+  ir->block[ir->nblocks++] = blk;
+}
+
+/* Function newBlock appends a new empty block
+ * with the given loop depth to the program
+ */
+static IrBlock * newBlock( IrProg * ir, int depth )
+{ IrBlock * blk = makeBlock(ir,depth);
+  placeBlock(ir,blk);
+  return blk;
+}
+
+/* Procedure addPred adds p to the predecessors
+ * of blk
+ */
+static void addPred( IrBlock * blk, IrBlock * p )
+{ if (blk->npreds >= blk->psize)
+  { blk->psize = blk->psize ? 2*blk->psize : 2;
+    blk->pred = (IrBlock **) realloc(blk->pred,blk->psize*sizeof(IrBlock *));
+  }
+  blk->pred[blk->npreds++] = p;
+}
+
+/* Procedure jump ends block from with a jump to
+ * block to
+ */
+static void jump( IrBlock * from, IrBlock * to )
+{ from->term = IrJump;
+  from->succ[0] = to;
+  addPred(to,from);
+}
+
+/* Function newPhi inserts a phi for variable
+ * var after the phis of blk
+ */
+static IrInst * newPhi( IrProg * ir, IrBlock * blk, int var, char * name )
+{ IrInst * before = blk->first;
+  IrInst * phi;
+  while ((before != NULL) && (before->op == IrPhi)) before = before->next;
+  phi = irNewInst(ir,blk,before,IrPhi,NULL,NULL);
+  phi->val = var; // phi的val记录它属于哪个变量
+  phi->name = name;
+  return phi;
+}
+
+/* Function trivialPhi returns the only value
+ * other than phi itself among its operands,
+ * or NULL if there are several
+ */
+static IrInst * trivialPhi( IrProg * ir, IrInst * phi )
+{ IrInst * same = NULL;
+  int k;
+  for (k=0;k<phi->block->npreds;k++)
+  { IrInst * v = resolve(phi->phiArg[k]);
+    if ((v == same) || (v == phi)) continue;
+    if (same != NULL) return NULL;
+    same = v;
+  }
+  return (same == NULL) ? zero(ir) : same;
+}
+
+static IrInst * readVar( IrProg * ir, int var, char * name, IrBlock * blk );
+
+/* Function addPhiOperands fills in the operands
+ * of phi from the predecessors of its block and
+ * returns the value the phi stands for
+ */
+static IrInst * addPhiOperands( IrProg * ir, IrInst * phi )
+{ IrBlock * blk = phi->block;
+  IrInst * same;
+  int k;
+  phi->phiArg = (IrInst **) malloc(blk->npreds*sizeof(IrInst *));
+  ir->ctx->allocBytes += blk->npreds*sizeof(IrInst *);
+  for (k=0;k<blk->npreds;k++)
+    phi->phiArg[k] = readVar(ir,phi->val,phi->name,blk->pred[k]);
+  same = trivialPhi(ir,phi);
+  if (same == NULL) return phi;
+  irRemove(phi); // 所有操作数相同的phi是多余的
+  phi->forward = same;
+  return same;
+}
+
+/* Function readVar returns the current value of
+ * variable var at the end of block blk
+ */
+static IrInst * readVar( IrProg * ir, int var, char * name, IrBlock * blk )
+{ DefTab * d = ir->defs;
+  IrInst * v;
+  if (d->size > 0)
+  { int i = defSlot(d,(long) blk->id * ir->nvars + var + 1);
+    if (d->key[i] != 0) return resolve(d->val[i]);
+  }
+  if (! blk->sealed)
+    v = newPhi(ir,blk,var,name); /* operands added by seal */
+  else if (blk->npreds == 0)
+    v = zero(ir);
+  else if (blk->npreds == 1)
+    v = readVar(ir,var,name,blk->pred[0]);
+  else
+  { v = newPhi(ir,blk,var,name);
+    writeVar(ir,var,blk,v); /* breaks cycles through loops */
+    v = addPhiOperands(ir,v);
+  }
+  writeVar(ir,var,blk,v);
+  return v;
+}
+
+/* Procedure seal records that all predecessors
+ * of blk are known and completes its phis
+ */
+static void seal( IrProg * ir, IrBlock * blk )
+{ IrInst * i, * next;
+  blk->sealed = TRUE;
+  for (i=blk->first;(i != NULL) && (i->op == IrPhi);i=next)
+  { next = i->next;
+    if (i->phiArg == NULL) addPhiOperands(ir,i);
+  }
+}
+
+static IrBlock * lowerStmts( IrProg * ir, TreeNode * t, IrBlock * cur,
+                             int depth, IrLoop * loop );
+
+/* Function lowerExp translates expression t at
+ * the end of block cur and returns its value
+ */
+static IrInst * lowerExp( IrProg * ir, TreeNode * t, IrBlock * cur )
+{ IrInst * v, * a, * b;
+  switch (t->kind.exp)
+  { case ConstK:
+      v = irNewInst(ir,cur,NULL,IrConst,NULL,NULL);
+      v->val = t->attr.val;
+      break;
+    case IdK:
+      return readVar(ir,t->symbol,t->attr.name,cur);
+    case OpK:
+      a = lowerExp(ir,t->child[0],cur);
+      b = lowerExp(ir,t->child[1],cur);
+      switch (t->attr.op)
+      { case PLUS: v = irNewInst(ir,cur,NULL,IrAdd,a,b); break;
+        case MINUS: v = irNewInst(ir,cur,NULL,IrSub,a,b); break;
+        case TIMES: v = irNewInst(ir,cur,NULL,IrMul,a,b); break;
+        case OVER: v = irNewInst(ir,cur,NULL,IrDiv,a,b); break;
+        default: /* comparisons only occur as tests */
+          v = irNewInst(ir,cur,NULL,IrSub,a,b);
+          break;
+      }
+      break;
+    default:
+      v = zero(ir);
+      break;
+  }
+  v->lineno = t->lineno;
+  return v;
+}
+
+/* Procedure lowerTest ends block cur with a
+ * branch on test t of profile site site to
+ * ifTrue or ifFalse
+ */
+static void lowerTest( IrProg * ir, TreeNode * t, IrBlock * cur,
+                       IrBlock * ifTrue, IrBlock * ifFalse, int site )
+{ if ((t->kind.exp == OpK) && ((t->attr.op == LT) || (t->attr.op == EQ)))
+  { cur->cond[0] = lowerExp(ir,t->child[0],cur);
+    cur->cond[1] = lowerExp(ir,t->child[1],cur);
+    cur->rel = t->attr.op;
+    cur->succ[0] = ifTrue;
+    cur->succ[1] = ifFalse;
+    cur->siteTrue = 0;
+  }
+  else /* a constant test left by folding: true unless 0 */
+  { cur->cond[0] = lowerExp(ir,t,cur);
+    cur->cond[1] = zero(ir);
+    cur->rel = EQ;
+    cur->succ[0] = ifFalse;
+    cur->succ[1] = ifTrue;
+    cur->siteTrue = 1;
+  }
+  cur->site = site;
+  cur->term = IrBranch;
+  addPred(ifTrue,cur);
+  addPred(ifFalse,cur);
+}
+
+/* Function lowerStmts translates the statement
+ * sequence t starting in block cur and returns
+ * the block where control continues
+ */
+// 块的创建顺序就是代码的排列顺序（剖析表明then部分更常执行时，then部分的块放在后面）；
+// 条件分支的目标如果有多个前驱，中间插入一个边块，phi的复制放在那里
+static IrBlock * lowerStmts( IrProg * ir, TreeNode * t, IrBlock * cur,
+                             int depth, IrLoop * loop )
+{ IrBlock * thenBlk, * elseBlk, * join, * header, * latch, * exit;
+  IrInst * v;
+  IrLoop * l;
+  int swap;
+  for (;t != NULL;t=t->sibling) // 兄弟结点用循环处理
+  { switch (t->kind.stmt)
+    { case IfK:
+        swap = hotThen(ir->ctx,t);
+        thenBlk = swap ? makeBlock(ir,depth) : newBlock(ir,depth);
+        elseBlk = newBlock(ir,depth); /* the else part or an edge block */
+        lowerTest(ir,t->child[0],cur,thenBlk,elseBlk,t->site);
+        if (swap) /* the then part ran more: place it last */
+        { elseBlk = lowerStmts(ir,t->child[2],elseBlk,depth,loop);
+          placeBlock(ir,thenBlk);
+        }
+        thenBlk = lowerStmts(ir,t->child[1],thenBlk,depth,loop);
+        if (! swap) elseBlk = lowerStmts(ir,t->child[2],elseBlk,depth,loop);
+        join = newBlock(ir,depth);
+        jump(thenBlk,join);
+        jump(elseBlk,join);
+        cur = join;
+        break;
+      case RepeatK:
+        l = (IrLoop *) calloc(1,sizeof(IrLoop));
+        if (ir->nloops >= ir->lsize)
+        { ir->lsize = ir->lsize ? 2*ir->lsize : 8;
+          ir->loop = (IrLoop **) realloc(ir->loop,ir->lsize*sizeof(IrLoop *));
+        }
+        ir->loop[ir->nloops++] = l;
+        l->parent = loop;
+        l->preheader = newBlock(ir,depth);
+        jump(cur,l->preheader);
+        header = newBlock(ir,depth+1);
+        header->sealed = FALSE; /* the back edge is not known yet */
+        jump(l->preheader,header);
+        cur = lowerStmts(ir,t->child[0],header,depth+1,l);
+        latch = newBlock(ir,depth+1);
+        exit = newBlock(ir,depth);
+        lowerTest(ir,t->child[1],cur,exit,latch,t->site); /* until: leave when true */
+        jump(latch,header);
+        seal(ir,header);
+        l->header = header;
+        l->latch = latch;
+        l->exit = exit;
+        cur = exit;
+        break;
+      case AssignK:
+        v = lowerExp(ir,t->child[0],cur);
+        if (v->name == NULL) v->name = t->attr.name;
+        writeVar(ir,t->symbol,cur,v);
+        break;
+      case ReadK:
+        v = irNewInst(ir,cur,NULL,IrRead,NULL,NULL);
+        v->name = t->attr.name;
+        v->lineno = t->lineno;
+        writeVar(ir,t->symbol,cur,v);
+        break;
+      case WriteK:
+        v = lowerExp(ir,t->child[0],cur);
+        v = irNewInst(ir,cur,NULL,IrWrite,v,NULL);
+        v->lineno = t->lineno;
+        break;
+      default:
+        break;
+    }
+  }
+  return cur;
+}
+
+/* Procedure removeTrivialPhis removes phis whose
+ * operands all became the same value and makes
+ * every operand refer to the final value
+ */
+static void removeTrivialPhis( IrProg * ir )
+{ int b, changed = TRUE;
+  IrInst * i, * next, * same;
+  while (changed)
+  { changed = FALSE;
+    for (b=0;b<ir->nblocks;b++)
+      for (i=ir->block[b]->first;(i != NULL) && (i->op == IrPhi);i=next)
+      { next = i->next;
+        if ((same = trivialPhi(ir,i)) != NULL)
+        { irRemove(i);
+          i->forward = same;
+          changed = TRUE;
+        }
+      }
+  }
+  irResolve(ir);
+}
+
+void irResolve( IrProg * ir )
+{ int b, k;
+  IrInst * i;
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b];
+    for (i=blk->first;i != NULL;i=i->next)
+    { i->arg[0] = resolve(i->arg[0]);
+      i->arg[1] = resolve(i->arg[1]);
+      if (i->op == IrPhi)
+        for (k=0;k<blk->npreds;k++) i->phiArg[k] = resolve(i->phiArg[k]);
+    }
+    blk->cond[0] = resolve(blk->cond[0]);
+    blk->cond[1] = resolve(blk->cond[1]);
+  }
+}
+
+IrProg * irLower( Context * ctx, TreeNode * syntaxTree )
+{ IrProg * ir = (IrProg *) calloc(1,sizeof(IrProg));
+  IrBlock * last;
+  ir->ctx = ctx;
+  ir->nvars = ctx->location;
+  ir->defs = (DefTab *) calloc(1,sizeof(DefTab));
+  last = lowerStmts(ir,syntaxTree,newBlock(ir,0),0,NULL);
+  last->term = IrHalt;
+  removeTrivialPhis(ir);
+  irNumber(ir);
+  return ir;
+}
+
+void irNumber( IrProg * ir )
+{ int b;
+  IrInst * i;
+  ir->nvalues = 0;
+  for (b=0;b<ir->nblocks;b++)
+    for (i=ir->block[b]->first;i != NULL;i=i->next)
+      i->id = ir->nvalues++;
+}
+
+// 块按编号排列时，除了repeat的回边，所有的边都从小编号指向大编号，
+// 所以按编号顺序一遍就能算出直接支配结点（Cooper等人的算法不需要迭代）：
+// 一个块的直接支配结点是它所有前向前驱在支配树上的最近公共祖先
+void irDominators( IrProg * ir )
+{ int b, k;
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b];
+    IrBlock * d = NULL;
+    for (k=0;k<blk->npreds;k++)
+    { IrBlock * p = blk->pred[k];
+      if (p->id >= blk->id) continue; /* a back edge */
+      while ((d != NULL) && (d != p)) // 求d和p的最近公共祖先
+      { while (p->id > d->id) p = p->idom;
+        while (d->id > p->id) d = d->idom;
+      }
+      d = p;
+    }
+    blk->idom = d;
+  }
+}
+
+int irDominates( IrBlock * a, IrBlock * b )
+{ while ((b != NULL) && (b->id > a->id)) b = b->idom;
+  return b == a;
+}
+
+int irHasEffect( IrInst * i )
+{ switch (i->op)
+  { case IrRead:
+    case IrWrite:
+      return TRUE;
+    case IrDiv: // 除数不是0和-1以外的常数时，可能在运行时出错停机
+      return (i->arg[1]->op != IrConst) ||
+             (i->arg[1]->val == 0) || (i->arg[1]->val == -1);
+    default:
+      return FALSE;
+  }
+}
+
+/* names of the operations in the dump */
+static char * irOpName[]
+   = { "const","add","sub","mul","div","read","write","phi" };
+
+void irDump( IrProg * ir, FILE * out, char * title )
+{ int b, k;
+  IrInst * i;
+  fprintf(out,"\nIR %s:\n",title);
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b];
+    fprintf(out,"\nB%d:",blk->id);
+    if (blk->npreds > 0)
+    { fprintf(out,"  preds");
+      for (k=0;k<blk->npreds;k++) fprintf(out," B%d",blk->pred[k]->id);
+    }
+    if (blk->depth > 0) fprintf(out,"  depth %d",blk->depth);
+    fprintf(out,"\n");
+    for (i=blk->first;i != NULL;i=i->next)
+    { if (i->op == IrWrite)
+        fprintf(out,"  %s %%%d",irOpName[i->op],i->arg[0]->id);
+      else
+      { fprintf(out,"  %%%d = %s",i->id,irOpName[i->op]);
+        if (i->op == IrConst) fprintf(out," %d",i->val);
+        else if (i->op == IrPhi)
+          for (k=0;k<blk->npreds;k++)
+            fprintf(out,"%s [%%%d, B%d]",k ? "," : "",
+                    i->phiArg[k]->id,blk->pred[k]->id);
+        else if (i->op != IrRead)
+          fprintf(out," %%%d, %%%d",i->arg[0]->id,i->arg[1]->id);
+      }
+      if (i->name != NULL) fprintf(out,"\t; %s",i->name);
+      fprintf(out,"\n");
+    }
+    switch (blk->term)
+    { case IrJump:
+        fprintf(out,"  jump B%d\n",blk->succ[0]->id);
+        break;
+      case IrBranch:
+        fprintf(out,"  branch %%%d %s %%%d ? B%d : B%d\n",
+                blk->cond[0]->id,blk->rel == LT ? "<" : "=",
+                blk->cond[1]->id,blk->succ[0]->id,blk->succ[1]->id);
+        break;
+      default:
+        fprintf(out,"  halt\n");
+        break;
+    }
+  }
+}
+
+void irFree( IrProg * ir )
+{ int k;
+  IrInst * i = ir->all;
+  while (i != NULL)
+  { IrInst * next = i->allNext;
+    free(i->phiArg);
+    free(i);
+    i = next;
+  }
+  for (k=0;k<ir->nblocks;k++)
+  { free(ir->block[k]->pred);
+    free(ir->block[k]);
+  }
+  for (k=0;k<ir->nloops;k++) free(ir->loop[k]);
+  free(ir->block);
+  free(ir->loop);
+  free(ir->defs->key);
+  free(ir->defs->val);
+  free(ir->defs);
+  free(ir);
+}
@@ -0,0 +1,174 @@
+/****************************************************/
+/* File: ir.h                                       */
+/* SSA intermediate representation for the         */
+/* TINY compiler (used at -O2)                      */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _IR_H_
+#define _IR_H_
+
+// 语法树和TM代码之间的中间表示：基本块组成控制流图，
+// 块内是SSA形式的指令，每条产生值的指令本身就代表这个值
+
+/* the IR operations; every operation except
+ * IrWrite defines a value
+ */
+typedef enum
+   { IrConst, /* val */
+     IrAdd, IrSub, IrMul, IrDiv, /* arg[0] op arg[1], as on TM */
+     IrRead, /* an integer read from input */
+     IrWrite, /* output arg[0] */
+     IrPhi /* phiArg[i] when entered from pred[i] */
+   } IrOp;
+
+/* how a basic block ends */
+typedef enum
+   { IrJump, /* to succ[0] */
+     IrBranch, /* to succ[0] if cond[0] rel cond[1], else succ[1] */
+     IrHalt /* stop the machine */
+   } IrTermKind;
+
+typedef struct irInstRec
+   { IrOp op;
+     int id; /* value number, in block order */
+     int val; /* IrConst: the constant */
+     struct irInstRec * arg[2]; /* operands */
+     struct irInstRec ** phiArg; /* IrPhi: one per predecessor */
+     struct irBlockRec * block; /* containing block */
+     struct irInstRec * prev, * next; /* in the block; phis first */
+     struct irInstRec * forward; /* the value replacing a removed instruction */
+     struct irInstRec * allNext; /* all instructions, for irFree */
+     char * name; /* variable assigned the value, NULL if none */
+     int lineno; /* source line */
+   } IrInst;
+
+typedef struct irBlockRec
+   { int id; /* index in IrProg.block */
+     IrInst * first, * last;
+     struct irBlockRec ** pred;
+     int npreds, psize;
+     IrTermKind term;
+     TokenType rel; /* IrBranch: LT or EQ, with TM semantics */
+     IrInst * cond[2]; /* IrBranch: compared values */
+     struct irBlockRec * succ[2];
+     int site; /* IrBranch: profile site of the test, -1 if none */
+     int siteTrue; /* IrBranch: index of the successor for a true test */
+     struct irBlockRec * idom; /* immediate dominator, NULL for the entry */
+     int depth; /* number of enclosing repeat loops */
+     int sealed; /* all predecessors are known */
+   } IrBlock;
+
+/* a repeat loop: blocks header..latch (by id)
+ * form the body; the preheader is the only
+ * predecessor of the header outside the loop
+ * and the latch jumps back to the header
+ */
+typedef struct irLoopRec
+   { IrBlock * preheader, * header, * latch, * exit;
+     struct irLoopRec * parent; /* enclosing loop, NULL if none */
+   } IrLoop;
+
+typedef struct irProgRec
+   { IrBlock ** block; /* entry first, in layout order */
+     int nblocks, bsize;
+     IrLoop ** loop; /* outer loops before inner ones */
+     int nloops, lsize;
+     int nvalues; /* values are numbered 0..nvalues-1 */
+     int nvars; /* variables are symbol table handles */
+     IrInst * all; /* every instruction ever allocated */
+     struct defTabRec * defs; /* SSA construction (ir.c) */
+     IrInst * zero; /* the value of an unassigned variable */
+     Context * ctx;
+   } IrProg;
+
+/* Function irLower translates a type checked
+ * syntax tree into SSA form
+ */
+IrProg * irLower( Context * ctx, TreeNode * syntaxTree );
+
+/* Function irNewInst creates an instruction with
+ * operands a and b (or NULL) and inserts it into
+ * block b before instruction before (or at the
+ * end if before is NULL)
+ */
+IrInst * irNewInst( IrProg * ir, IrBlock * blk, IrInst * before,
+                    IrOp op, IrInst * a, IrInst * b );
+
+/* Procedure irInsert links instruction i, which
+ * is in no block, into block blk before
+ * instruction before (or at the end)
+ */
+void irInsert( IrInst * i, IrBlock * blk, IrInst * before );
+
+/* Procedure irRemove unlinks instruction i from
+ * its block; its storage is released by irFree
+ */
+void irRemove( IrInst * i );
+
+/* Procedure irResolve makes every operand refer
+ * to the value replacing it, following the
+ * forward links of removed instructions
+ */
+void irResolve( IrProg * ir );
+
+/* Procedure irDominators computes the immediate
+ * dominator of every block
+ */
+void irDominators( IrProg * ir );
+
+/* Function irDominates returns TRUE if every path
+ * from the entry to block b goes through block a
+ */
+int irDominates( IrBlock * a, IrBlock * b );
+
+/* Procedure irNumber renumbers the values in
+ * block order
+ */
+void irNumber( IrProg * ir );
+
+/* Function irHasEffect returns TRUE if i must be
+ * executed even when its value is not used:
+ * input, output and a division that may trap
+ */
+int irHasEffect( IrInst * i );
+
+/* Procedure irDump prints the IR to out; title
+ * names the point in the pipeline
+ */
+void irDump( IrProg * ir, FILE * out, char * title );
+
+/* Procedure irFree releases the IR */
+void irFree( IrProg * ir );
+
+/* Procedure irDeadCode removes the instructions
+ * whose values are never used and that have no
+ * effect (iropt.c)
+ */
+void irDeadCode( IrProg * ir );
+
+/* Procedure irValueNumber removes instructions
+ * computing a value already computed earlier in
+ * the same block (iropt.c)
+ */
+void irValueNumber( IrProg * ir );
+
+/* Procedure irHoist moves the computations
+ * whose operands do not change in a repeat loop
+ * to the preheader of the loop (iropt.c)
+ */
+void irHoist( IrProg * ir );
+
+/* Procedure irReduce replaces multiplications of
+ * induction variables by loop invariants with
+ * additions carried around the loop (iropt.c)
+ */
+void irReduce( IrProg * ir );
+
+/* Procedure irCodeGen generates TM code for the
+ * syntax tree through the IR, at the current
+ * code position (irtm.c)
+ */
+void irCodeGen( Context * ctx, TreeNode * syntaxTree );
+
+#endif
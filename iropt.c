@@ -0,0 +1,364 @@
+/****************************************************/
+/* File: iropt.c                                    */
+/* Optimizations on the SSA intermediate            */
+/* representation for the TINY compiler             */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "ir.h"
+
+/* Procedure markUsed marks value v as used,
+ * pushing it on the work list if it was not
+ */
+static void markUsed( char * used, IrInst ** work, int * n, IrInst * v )
+{ if ((v != NULL) && ! used[v->id])
+  { used[v->id] = TRUE;
+    work[(*n)++] = v;
+  }
+}
+
+// 标记-清除：从有副作用的指令和分支条件出发，沿操作数标记所有被用到的值，
+// 没有被标记的指令都可以删除。SSA中每个值只有一个定义，
+// 所以这就是对每个值的活跃性分析，被删指令的操作数自然不算被使用
+void irDeadCode( IrProg * ir )
+{ char * used = (char *) calloc(ir->nvalues,sizeof(char));
+  IrInst ** work = (IrInst **) malloc(ir->nvalues*sizeof(IrInst *));
+  int n = 0, b, k;
+  IrInst * i, * next;
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b];
+    for (i=blk->first;i != NULL;i=i->next)
+      if (irHasEffect(i)) markUsed(used,work,&n,i);
+    if (blk->term == IrBranch)
+    { markUsed(used,work,&n,blk->cond[0]);
+      markUsed(used,work,&n,blk->cond[1]);
+    }
+  }
+  while (n > 0)
+  { i = work[--n];
+    markUsed(used,work,&n,i->arg[0]);
+    markUsed(used,work,&n,i->arg[1]);
+    if (i->op == IrPhi)
+      for (k=0;k<i->block->npreds;k++) markUsed(used,work,&n,i->phiArg[k]);
+  }
+  for (b=0;b<ir->nblocks;b++)
+    for (i=ir->block[b]->first;i != NULL;i=next)
+    { next = i->next;
+      if (! used[i->id])
+      { if (i == ir->zero) ir->zero = NULL;
+        irRemove(i);
+      }
+    }
+  free(used);
+  free(work);
+  irNumber(ir);
+}
+
+/* Function sameValue returns TRUE if
+ * instructions a and b in the same block always
+ * compute the same value
+ */
+static int sameValue( IrInst * a, IrInst * b )
+{ int k;
+  if ((a->op != b->op) || (a->arg[0] != b->arg[0]) || (a->arg[1] != b->arg[1]))
+    return FALSE;
+  switch (a->op)
+  { case IrConst:
+      return a->val == b->val;
+    case IrPhi:
+      for (k=0;k<a->block->npreds;k++)
+        if (a->phiArg[k] != b->phiArg[k]) return FALSE;
+      return TRUE;
+    case IrRead: /* each read consumes a new input */
+    case IrWrite:
+      return FALSE;
+    default:
+      return TRUE;
+  }
+}
+
+/* Function hashValue returns the hash code of
+ * the value computed by i
+ */
+static unsigned hashValue( IrInst * i )
+{ unsigned h = i->op;
+  int k;
+  if (i->op == IrConst) h = h*31 + (unsigned) i->val;
+  if (i->arg[0] != NULL) h = h*31 + i->arg[0]->id;
+  if (i->arg[1] != NULL) h = h*31 + i->arg[1]->id;
+  if (i->op == IrPhi)
+    for (k=0;k<i->block->npreds;k++) h = h*31 + i->phiArg[k]->id;
+  return h * 2654435761u;
+}
+
+/* Function resolveArg returns the value that
+ * replaces v
+ */
+static IrInst * resolveArg( IrInst * v )
+{ while ((v != NULL) && (v->forward != NULL)) v = v->forward;
+  return v;
+}
+
+// 局部值编号：块内按顺序把每条指令按(操作,操作数)散列，
+// 遇到已经算过的值就删掉这条指令，以后对它的使用都改为原来的值。
+// SSA中变量的每次赋值和read都产生新的值，旧值永远不会失效，
+// 所以不需要在赋值和read处清空散列表；x:=y这样的复制在构造SSA时
+// 就已经传播掉了（x的定义直接就是y的值）
+void irValueNumber( IrProg * ir )
+{ int b, k, size = 0, removed = FALSE;
+  IrInst ** table = NULL;
+  IrInst * i, * next, * t;
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b];
+    int n = 0;
+    for (i=blk->first;i != NULL;i=i->next) n++;
+    if (2*n > size) // 装填因子不超过1/2
+    { while (2*n > size) size = size ? 2*size : 64;
+      free(table);
+      table = (IrInst **) malloc(size*sizeof(IrInst *));
+    }
+    for (k=0;k<size;k++) table[k] = NULL;
+    for (i=blk->first;i != NULL;i=next)
+    { unsigned h;
+      next = i->next;
+      i->arg[0] = resolveArg(i->arg[0]);
+      i->arg[1] = resolveArg(i->arg[1]);
+      if (i->op == IrPhi)
+        for (k=0;k<blk->npreds;k++) i->phiArg[k] = resolveArg(i->phiArg[k]);
+      if (((i->op == IrAdd) || (i->op == IrMul)) &&
+          (i->arg[0]->id > i->arg[1]->id)) /* commutative: order the operands */
+      { t = i->arg[0];
+        i->arg[0] = i->arg[1];
+        i->arg[1] = t;
+      }
+      if ((i->op == IrRead) || (i->op == IrWrite)) continue;
+      h = hashValue(i) & (size-1);
+      while ((table[h] != NULL) && ! sameValue(table[h],i)) h = (h+1) & (size-1);
+      if (table[h] == NULL) table[h] = i;
+      else
+      { if (i == ir->zero) ir->zero = table[h];
+        irRemove(i);
+        i->forward = table[h];
+        removed = TRUE;
+      }
+    }
+  }
+  free(table);
+  if (removed) irResolve(ir);
+}
+
+/* Function inLoop returns TRUE if block blk is
+ * part of the body of loop l
+ */
+static int inLoop( IrLoop * l, IrBlock * blk )
+{ return (blk->id >= l->header->id) && (blk->id <= l->latch->id); }
+
+/* Function invariant returns TRUE if i computes
+ * the same value on every iteration of loop l
+ * and may be executed before the loop; constant
+ * operands are copied along
+ */
+static int invariant( IrLoop * l, IrInst * i )
+{ int k;
+  switch (i->op)
+  { case IrAdd:
+    case IrSub:
+    case IrMul:
+    case IrDiv:
+      if (irHasEffect(i)) return FALSE; /* a division that may trap */
+      for (k=0;k<2;k++)
+        if ((i->arg[k]->op != IrConst) && inLoop(l,i->arg[k]->block))
+          return FALSE;
+      return TRUE;
+    default: /* constants stay where they are used */
+      return FALSE;
+  }
+}
+
+// 循环不变量外提：由内向外处理每个repeat循环，按块的顺序
+// 把操作数都在循环外定义的指令移到前置块的末尾。
+// 移走的指令所在的块变成了前置块，依赖它的指令随后也会被判为不变量，
+// 内层前置块本身在外层循环中，所以不变量可以逐层外提。
+// repeat的循环体至少执行一次，外提不会让本来不执行的计算多执行；
+// 可能除以0的DIV不外提，否则出错会提前到循环中更早的输出之前
+void irHoist( IrProg * ir )
+{ int n, b, k;
+  IrInst * i, * next;
+  for (n=ir->nloops-1;n>=0;n--) /* inner loops first */
+  { IrLoop * l = ir->loop[n];
+    for (b=l->header->id;b<=l->latch->id;b++)
+      for (i=ir->block[b]->first;i != NULL;i=next)
+      { next = i->next;
+        if (invariant(l,i))
+        { for (k=0;k<2;k++)
+            if ((i->arg[k]->op == IrConst) && inLoop(l,i->arg[k]->block))
+            { int v = i->arg[k]->val;
+              i->arg[k] = irNewInst(ir,l->preheader,NULL,IrConst,NULL,NULL);
+              i->arg[k]->val = v;
+            }
+          irRemove(i);
+          irInsert(i,l->preheader,NULL);
+        }
+      }
+  }
+  irNumber(ir);
+}
+
+/* Function loopInvariant returns TRUE if value v
+ * does not change in loop l
+ */
+static int loopInvariant( IrLoop * l, IrInst * v )
+{ return (v->op == IrConst) || ! inLoop(l,v->block); }
+
+/* Function invariantCopy returns v, or a copy of
+ * v in the preheader of l if v is a constant
+ * inside the loop
+ */
+static IrInst * invariantCopy( IrProg * ir, IrLoop * l, IrInst * v )
+{ IrInst * c;
+  if (! inLoop(l,v->block)) return v;
+  c = irNewInst(ir,l->preheader,NULL,IrConst,NULL,NULL);
+  c->val = v->val;
+  return c;
+}
+
+/* Function newConst returns a new constant v
+ * inserted before instruction before
+ */
+static IrInst * newConst( IrProg * ir, IrBlock * blk, IrInst * before, int v )
+{ IrInst * c = irNewInst(ir,blk,before,IrConst,NULL,NULL);
+  c->val = v;
+  return c;
+}
+
+/* MULCOST = TM instructions per iteration for a
+ * multiplication by a loop invariant (load it,
+ * MUL); IVCOST = for an induction variable kept
+ * in memory (load, LDA, store and the copy on
+ * the back edge), one more if its step is not a
+ * constant
+ */
+#define MULCOST 2
+#define IVCOST 5
+
+/* Function factor returns the loop invariant
+ * operand of i if i multiplies it by phi or by
+ * next, otherwise NULL
+ */
+static IrInst * factor( IrLoop * l, IrInst * i, IrInst * phi, IrInst * next )
+{ int k;
+  if (i->op != IrMul) return NULL;
+  for (k=0;k<2;k++)
+    if (((i->arg[1-k] == phi) || (i->arg[1-k] == next)) &&
+        loopInvariant(l,i->arg[k]))
+      return i->arg[k];
+  return NULL;
+}
+
+/* Function sameFactor returns TRUE if loop
+ * invariants a and b have the same value
+ */
+static int sameFactor( IrInst * a, IrInst * b )
+{ return (a == b) ||
+         ((a->op == IrConst) && (b->op == IrConst) && (a->val == b->val));
+}
+
+/* Procedure reduce replaces the multiplications
+ * of the basic induction variable phi (stepping
+ * by step each iteration, to next) by loop
+ * invariants with new induction variables
+ * where that saves instructions; dominators
+ * must be known
+ */
+// 基本归纳变量i = phi(i0, i+c)；循环中的i*k换成新的归纳变量
+// j = phi(i0*k, j+c*k)，(i+c)*k换成j+c*k。乘法按32位回绕，加法同样回绕，
+// 两者在模2^32下完全相同。TM上MUL和ADD一样只要一条指令，
+// 而新的归纳变量每次迭代要取、加、存，所以只有它代替了足够多的乘法才合算
+static void reduce( IrProg * ir, IrLoop * l, IrInst * phi, IrInst * next,
+                    int step )
+{ IrBlock * header = l->header;
+  int kp = 0, kl = 1, b, j, m, n = 0, count;
+  IrInst ** mul, * i, * q, * qnext, * stepV, * kv, * init;
+  if (header->pred[0] != l->preheader) { kp = 1; kl = 0; }
+  for (b=header->id;b<=l->latch->id;b++)
+    for (i=ir->block[b]->first;i != NULL;i=i->next) n++;
+  mul = (IrInst **) malloc(n*sizeof(IrInst *));
+  n = 0;
+  for (b=header->id;b<=l->latch->id;b++)
+    for (i=ir->block[b]->first;i != NULL;i=i->next)
+      if (factor(l,i,phi,next) != NULL) mul[n++] = i;
+  for (j=0;j<n;j++)
+  { if (mul[j] == NULL) continue;
+    kv = factor(l,mul[j],phi,next);
+    count = 0; /* the multiplications done on every iteration */
+    for (m=j;m<n;m++)
+      if ((mul[m] != NULL) && sameFactor(factor(l,mul[m],phi,next),kv) &&
+          irDominates(mul[m]->block,l->latch))
+        count++;
+    if (count*MULCOST <= IVCOST + (kv->op != IrConst))
+    { for (m=j;m<n;m++) /* not worth it */
+        if ((mul[m] != NULL) && sameFactor(factor(l,mul[m],phi,next),kv))
+          mul[m] = NULL;
+      continue;
+    }
+    kv = invariantCopy(ir,l,kv);
+    init = phi->phiArg[kp];
+    if (kv->op == IrConst) /* the new step is known */
+      stepV = newConst(ir,next->block,next->next,
+                       (int) ((unsigned) step * (unsigned) kv->val));
+    else if (step == 1)
+      stepV = kv;
+    else
+      stepV = irNewInst(ir,l->preheader,NULL,IrMul,kv,
+                        newConst(ir,l->preheader,NULL,step));
+    if ((init->op == IrConst) && (kv->op == IrConst))
+      init = newConst(ir,l->preheader,NULL,
+                      (int) ((unsigned) init->val * (unsigned) kv->val));
+    else
+      init = irNewInst(ir,l->preheader,NULL,IrMul,init,kv);
+    q = irNewInst(ir,header,header->first,IrPhi,NULL,NULL);
+    q->val = -1; /* not a source variable */
+    q->lineno = mul[j]->lineno;
+    q->phiArg = (IrInst **) malloc(2*sizeof(IrInst *));
+    ir->ctx->allocBytes += 2*sizeof(IrInst *);
+    q->phiArg[kp] = init;
+    qnext = irNewInst(ir,next->block,next->next,IrAdd,q,stepV);
+    q->phiArg[kl] = qnext;
+    for (m=n-1;m>=j;m--)
+    { i = mul[m];
+      if ((i == NULL) || ! sameFactor(factor(l,i,phi,next),factor(l,mul[j],phi,next)))
+        continue;
+      i->forward = ((i->arg[0] == phi) || (i->arg[1] == phi)) ? q : qnext;
+      irRemove(i);
+      mul[m] = NULL;
+    }
+  }
+  free(mul);
+}
+
+// 强度削弱：在每个循环头找基本归纳变量，即每次迭代加减一个常数的phi，
+// 它们与循环不变量的乘法改为每次迭代的加法（后端把加常数生成一条LDA）
+void irReduce( IrProg * ir )
+{ int n, k;
+  IrInst * phi, * next;
+  irDominators(ir);
+  for (n=ir->nloops-1;n>=0;n--)
+  { IrLoop * l = ir->loop[n];
+    IrBlock * header = l->header;
+    if (header->npreds != 2) continue;
+    k = (header->pred[0] == l->latch) ? 0 : 1;
+    for (phi=header->first;(phi != NULL) && (phi->op == IrPhi);phi=phi->next)
+    { next = phi->phiArg[k];
+      if (! inLoop(l,next->block)) continue;
+      if ((next->op == IrAdd) && (next->arg[0] == phi) && (next->arg[1]->op == IrConst))
+        reduce(ir,l,phi,next,next->arg[1]->val);
+      else if ((next->op == IrAdd) && (next->arg[1] == phi) && (next->arg[0]->op == IrConst))
+        reduce(ir,l,phi,next,next->arg[0]->val);
+      else if ((next->op == IrSub) && (next->arg[0] == phi) && (next->arg[1]->op == IrConst))
+        reduce(ir,l,phi,next,(int) (0u - (unsigned) next->arg[1]->val));
+    }
+  }
+  irResolve(ir);
+  irNumber(ir);
+}
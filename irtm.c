@@ -0,0 +1,961 @@
+/****************************************************/
+/* File: irtm.c                                     */
+/* TM code generation from the SSA intermediate     */
+/* representation for the TINY compiler             */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "code.h"
+#include "ir.h"
+#include "profile.h"
+#include <limits.h>
+
+// 值的存放：在定义它的块之外还要用到的值（以及所有phi）有自己的家，
+// phi和它的操作数活跃范围不相交时共用一个家，这样就不用复制。
+// 用得最多的家放在寄存器2～4中（活跃范围相交的家不共用寄存器），其余的在gp区
+// 有内存单元，定义后立即存入；只在块内活跃的值放在寄存器0～4中没有被家占用的那些里，
+// 寄存器不够时溢出到mp栈上。常数不占内存，用到时再LDC。
+// 离开块时phi的复制是并行的：先读出所有源值，再写入各phi的家
+
+/* NREGS = number of registers for values (0..4) */
+#define NREGS 5
+
+/* MAXWEIGHT bounds the estimated number of times
+ * a block is executed
+ */
+#define MAXWEIGHT 100000L
+
+/* LATER marks a phi source read when the phi is
+ * written: a constant or a value in memory, which
+ * no phi copy can overwrite
+ */
+#define LATER (-2)
+
+/* a forward jump waiting for its target block */
+typedef struct
+   { int loc;
+     OpCode op;
+     int r;
+     IrBlock * target;
+   } Fixup;
+
+/* the state of the code generator */
+typedef struct
+   { Context * ctx;
+     IrProg * ir;
+     int * home; /* home of each value, named by one of the values
+                    sharing it; -1 if none */
+     int * hreg; /* register that is the home of each value, -1 if none */
+     int * slot; /* gp offset of the home of each value, -1 if none */
+     int * reg; /* register holding each value, -1 if none */
+     int * spill; /* mp offset of a spilled value, 1 if none */
+     int * uses; /* uses of each value left in the current block */
+     IrInst * regVal[NREGS]; /* value held by each register */
+     int pinned[NREGS]; /* register is an operand being used */
+     int busy[NREGS]; /* register is a home live in the current block */
+     int nfree; /* registers not busy in the current block */
+     int * mask; /* the registers busy in each block, as bits */
+     int * start; /* code location of each block, -1 until emitted */
+     IrBlock ** target; /* where control entering each block goes */
+     Fixup * fix;
+     int nfix, fsize;
+   } Gen;
+
+/* Procedure freeReg forgets the value in
+ * register r
+ */
+static void freeReg( Gen * g, int r )
+{ if (g->regVal[r] != NULL) g->reg[g->regVal[r]->id] = -1;
+  g->regVal[r] = NULL;
+}
+
+/* Function allocReg returns a free register,
+ * evicting a value if necessary: preferably one
+ * that can be reloaded, otherwise it is spilled
+ * to the mp stack
+ */
+static int allocReg( Gen * g )
+{ int r, victim = -1;
+  for (r=0;r<NREGS;r++)
+    if ((g->regVal[r] == NULL) && ! g->pinned[r] && ! g->busy[r]) return r;
+  for (r=0;r<NREGS;r++)
+  { IrInst * v = g->regVal[r];
+    if (g->pinned[r] || g->busy[r]) continue;
+    if ((v->op == IrConst) || (g->slot[v->id] >= 0) || (g->spill[v->id] <= 0))
+    { freeReg(g,r);
+      return r;
+    }
+    if (victim < 0) victim = r;
+  }
+  r = victim; // 没有可以直接丢弃的值，只好压栈
+  g->spill[g->regVal[r]->id] = g->ctx->tmpOffset;
+  emitRM(g->ctx,opST,r,g->ctx->tmpOffset--,mp,"ir: spill");
+  freeReg(g,r);
+  return r;
+}
+
+/* Procedure setReg records that register r
+ * holds value v
+ */
+static void setReg( Gen * g, int r, IrInst * v )
+{ g->regVal[r] = v;
+  g->reg[v->id] = r;
+}
+
+/* Function use returns a register holding
+ * value v, loading it if necessary
+ */
+static int use( Gen * g, IrInst * v )
+{ int r = g->hreg[v->id];
+  if (r >= 0) return r; /* in its home */
+  r = g->reg[v->id];
+  if (r >= 0) return r;
+  r = allocReg(g);
+  if (v->op == IrConst)
+    emitRM(g->ctx,opLDC,r,v->val,0,"ir: load const");
+  else if (g->slot[v->id] >= 0)
+    emitRM(g->ctx,opLD,r,g->slot[v->id],gp,"ir: load value");
+  else if (g->spill[v->id] <= 0)
+    emitRM(g->ctx,opLD,r,g->spill[v->id],mp,"ir: reload spilled value");
+  else
+    emitComment(g->ctx,"BUG: value not available");
+  setReg(g,r,v);
+  return r;
+}
+
+/* Procedure release records one use of v; its
+ * register is freed after the last use
+ */
+static void release( Gen * g, IrInst * v )
+{ if ((--g->uses[v->id] <= 0) && (g->reg[v->id] >= 0) &&
+      ! g->pinned[g->reg[v->id]])
+    freeReg(g,g->reg[v->id]);
+}
+
+/* Procedure define records that the value of i
+ * was computed into register r
+ */
+static void define( Gen * g, IrInst * i, int r )
+{ if (g->hreg[i->id] >= 0) return; /* computed in its home */
+  setReg(g,r,i);
+  if (g->slot[i->id] >= 0)
+    emitRM(g->ctx,opST,r,g->slot[i->id],gp,"ir: store value");
+  if (g->uses[i->id] <= 0) freeReg(g,r);
+}
+
+/* Function result returns the register to
+ * compute the value of i in: its home if that
+ * is a register, otherwise a free one
+ */
+static int result( Gen * g, IrInst * i )
+{ return g->hreg[i->id] >= 0 ? g->hreg[i->id] : allocReg(g); }
+
+/* Function predIndex returns the index of p
+ * among the predecessors of blk
+ */
+static int predIndex( IrBlock * blk, IrBlock * p )
+{ int k;
+  for (k=0;k<blk->npreds;k++)
+    if (blk->pred[k] == p) return k;
+  return -1;
+}
+
+/* Function hasPhis returns TRUE if blk starts
+ * with a phi
+ */
+static int hasPhis( IrBlock * blk )
+{ return (blk->first != NULL) && (blk->first->op == IrPhi); }
+
+/* Procedure genJump emits a jump with opcode op
+ * on register r to block blk
+ */
+static void genJump( Gen * g, OpCode op, int r, IrBlock * blk )
+{ blk = g->target[blk->id];
+  if (g->start[blk->id] >= 0)
+    emitRM_Abs(g->ctx,op,r,g->start[blk->id],"ir: jump");
+  else // 向前跳转，目标地址待回填
+  { if (g->nfix >= g->fsize)
+    { g->fsize = g->fsize ? 2*g->fsize : 64;
+      g->fix = (Fixup *) realloc(g->fix,g->fsize*sizeof(Fixup));
+    }
+    g->fix[g->nfix].loc = emitSkip(g->ctx,1);
+    g->fix[g->nfix].op = op;
+    g->fix[g->nfix].r = r;
+    g->fix[g->nfix].target = blk;
+    g->nfix++;
+  }
+}
+
+/* Function sameHome returns TRUE if values a
+ * and b are kept in the same home
+ */
+static int sameHome( Gen * g, IrInst * a, IrInst * b )
+{ return (g->home[a->id] >= 0) && (g->home[a->id] == g->home[b->id]); }
+
+/* Function overwritten returns TRUE if one of
+ * the phi copies on the edge entering succ from
+ * its k-th predecessor writes register r
+ */
+static int overwritten( Gen * g, IrBlock * succ, int k, int r )
+{ IrInst * p;
+  for (p=succ->first;(p != NULL) && (p->op == IrPhi);p=p->next)
+    if ((g->hreg[p->id] == r) && (p->phiArg[k] != p) &&
+        ! sameHome(g,p->phiArg[k],p))
+      return TRUE;
+  return FALSE;
+}
+
+/* Procedure genCopies emits the phi copies for
+ * the edge from blk to its successor succ
+ */
+// 源值如果在某个phi的家寄存器里，要先移开，免得先写的phi把它覆盖了
+static void genCopies( Gen * g, IrBlock * blk, IrBlock * succ )
+{ int k = predIndex(succ,blk);
+  int n = 0, j, kept = 0;
+  IrInst * p;
+  int * from;
+  for (p=succ->first;(p != NULL) && (p->op == IrPhi);p=p->next) n++;
+  from = (int *) malloc(n*sizeof(int));
+  /* read every source a copy may overwrite first ... */
+  for (p=succ->first, j=0;(p != NULL) && (p->op == IrPhi);p=p->next, j++)
+  { IrInst * src = p->phiArg[k];
+    int r = g->hreg[src->id];
+    from[j] = -1;
+    if ((src == p) || sameHome(g,src,p)) continue;
+    if ((r < 0) && ((src->op == IrConst) || (g->slot[src->id] >= 0)))
+    { from[j] = LATER;
+      continue;
+    }
+    if (r < 0)
+      r = use(g,src);
+    else if (! overwritten(g,succ,k,r))
+    { from[j] = r; /* in its home until the end */
+      continue;
+    }
+    else if (kept < g->nfree-1)
+    { int t = allocReg(g);
+      emitRM(g->ctx,opLDA,t,0,r,"ir: save phi source");
+      r = t;
+    }
+    if (g->pinned[r] || ((kept < g->nfree-1) && ! g->busy[r]))
+    { if (! g->pinned[r]) kept++;
+      g->pinned[r] = TRUE;
+      from[j] = r;
+    }
+    else /* out of registers: keep it on the mp stack */
+    { from[j] = NREGS - g->ctx->tmpOffset; // 大于等于NREGS表示栈上的位置
+      emitRM(g->ctx,opST,r,g->ctx->tmpOffset--,mp,"ir: save phi source");
+    }
+    release(g,src);
+  }
+  /* ... then write the phis */
+  for (p=succ->first, j=0;(p != NULL) && (p->op == IrPhi);p=p->next, j++)
+  { IrInst * src = p->phiArg[k];
+    int r = from[j], h = g->hreg[p->id];
+    if (r == -1) continue;
+    if (r == LATER)
+    { if ((h >= 0) && (g->reg[src->id] < 0))
+      { if (src->op == IrConst)
+          emitRM(g->ctx,opLDC,h,src->val,0,"ir: phi copy");
+        else
+          emitRM(g->ctx,opLD,h,g->slot[src->id],gp,"ir: phi copy");
+        release(g,src);
+        continue;
+      }
+      r = use(g,src);
+      release(g,src);
+    }
+    else if (r >= NREGS)
+    { int tmp = NREGS - r;
+      r = (h >= 0) ? h : allocReg(g);
+      emitRM(g->ctx,opLD,r,tmp,mp,"ir: load phi source");
+    }
+    if (h < 0)
+      emitRM(g->ctx,opST,r,g->slot[p->id],gp,"ir: phi copy");
+    else if (r != h)
+      emitRM(g->ctx,opLDA,h,0,r,"ir: phi copy");
+  }
+  for (j=0;j<NREGS;j++) g->pinned[j] = FALSE;
+  free(from);
+}
+
+/* Procedure countUses counts the uses of values
+ * in block blk, including its terminator and
+ * the phi copies on its outgoing jump
+ */
+static void countUses( Gen * g, IrBlock * blk )
+{ IrInst * i;
+  int k;
+  for (i=blk->first;i != NULL;i=i->next)
+    if (i->op != IrPhi)
+    { if (i->arg[0] != NULL) g->uses[i->arg[0]->id]++;
+      if (i->arg[1] != NULL) g->uses[i->arg[1]->id]++;
+    }
+  if (blk->term == IrBranch)
+  { g->uses[blk->cond[0]->id]++;
+    g->uses[blk->cond[1]->id]++;
+  }
+  else if ((blk->term == IrJump) && hasPhis(blk->succ[0]))
+  { k = predIndex(blk->succ[0],blk);
+    for (i=blk->succ[0]->first;(i != NULL) && (i->op == IrPhi);i=i->next)
+      if (! sameHome(g,i->phiArg[k],i)) g->uses[i->phiArg[k]->id]++;
+  }
+}
+
+/* Function addConst returns the index of the
+ * constant operand of i if it adds or subtracts
+ * a constant (one LDA), otherwise -1
+ */
+static int addConst( IrInst * i )
+{ if ((i->op == IrAdd) && (i->arg[1]->op == IrConst)) return 1;
+  if ((i->op == IrAdd) && (i->arg[0]->op == IrConst)) return 0;
+  if ((i->op == IrSub) && (i->arg[1]->op == IrConst) &&
+      (i->arg[1]->val != INT_MIN)) /* -INT_MIN overflows */
+    return 1;
+  return -1;
+}
+
+/* Procedure genInst emits code for instruction i */
+static void genInst( Gen * g, IrInst * i )
+{ int ra, rb, r, k;
+  switch (i->op)
+  { case IrPhi: /* in its home already */
+    case IrConst: /* loaded where used */
+      break;
+    case IrRead:
+      r = result(g,i);
+      emitRO(g->ctx,opIN,r,0,0,"ir: read");
+      define(g,i,r);
+      break;
+    case IrWrite:
+      r = use(g,i->arg[0]);
+      emitRO(g->ctx,opOUT,r,0,0,"ir: write");
+      release(g,i->arg[0]);
+      break;
+    case IrAdd:
+    case IrSub:
+      if ((k = addConst(i)) >= 0)
+      { ra = use(g,i->arg[1-k]);
+        release(g,i->arg[1-k]);
+        release(g,i->arg[k]);
+        r = result(g,i);
+        emitRM(g->ctx,opLDA,r,i->op == IrAdd ? i->arg[k]->val : -i->arg[k]->val,
+               ra,i->op == IrAdd ? "ir: add const" : "ir: sub const");
+        define(g,i,r);
+        break;
+      }
+      /* fall through */
+    default:
+      ra = use(g,i->arg[0]);
+      g->pinned[ra] = TRUE;
+      rb = use(g,i->arg[1]);
+      g->pinned[ra] = FALSE;
+      release(g,i->arg[0]);
+      release(g,i->arg[1]);
+      r = result(g,i); // 操作数的寄存器可以直接给结果用
+      switch (i->op)
+      { case IrAdd: emitRO(g->ctx,opADD,r,ra,rb,"ir: add"); break;
+        case IrSub: emitRO(g->ctx,opSUB,r,ra,rb,"ir: sub"); break;
+        case IrMul: emitRO(g->ctx,opMUL,r,ra,rb,"ir: mul"); break;
+        default: emitRO(g->ctx,opDIV,r,ra,rb,"ir: div"); break;
+      }
+      define(g,i,r);
+      break;
+  }
+}
+
+/* Procedure genBranch emits the test and jumps
+ * ending block blk; next is the block emitted
+ * after it
+ */
+static void genBranch( Gen * g, IrBlock * blk, IrBlock * next )
+{ IrBlock * ifTrue = g->target[blk->succ[0]->id];
+  IrBlock * ifFalse = g->target[blk->succ[1]->id];
+  OpCode jTrue = blk->rel == LT ? opJLT : opJEQ;
+  OpCode jFalse = blk->rel == LT ? opJGE : opJNE;
+  int ra, rb, r;
+  if (hasPhis(blk->succ[0]) || hasPhis(blk->succ[1]))
+    emitComment(g->ctx,"BUG: phi copies on a branch");
+  ra = use(g,blk->cond[0]);
+  if ((blk->cond[1]->op == IrConst) && (blk->cond[1]->val == 0))
+    r = ra; /* compare with 0: test the value itself */
+  else if ((blk->cond[1]->op == IrConst) && (blk->cond[1]->val != INT_MIN))
+  { r = allocReg(g);
+    emitRM(g->ctx,opLDA,r,-blk->cond[1]->val,ra,"ir: compare const");
+  }
+  else
+  { g->pinned[ra] = TRUE;
+    rb = use(g,blk->cond[1]);
+    g->pinned[ra] = FALSE;
+    r = allocReg(g);
+    emitRO(g->ctx,opSUB,r,ra,rb,"ir: compare");
+  }
+  if (ifTrue == next)
+  { emitSite(g->ctx,blk->site,blk->siteTrue == 1);
+    genJump(g,jFalse,r,ifFalse);
+  }
+  else
+  { emitSite(g->ctx,blk->site,blk->siteTrue == 0);
+    genJump(g,jTrue,r,ifTrue);
+    if (ifFalse != next) genJump(g,opLDA,pc,ifFalse);
+  }
+}
+
+/* Function needsCopies returns TRUE if the jump
+ * ending blk has phi copies to do
+ */
+static int needsCopies( Gen * g, IrBlock * blk )
+{ int k = predIndex(blk->succ[0],blk);
+  IrInst * p;
+  for (p=blk->succ[0]->first;(p != NULL) && (p->op == IrPhi);p=p->next)
+    if ((p->phiArg[k] != p) && ! sameHome(g,p->phiArg[k],p)) return TRUE;
+  return FALSE;
+}
+
+/* Function isEmpty returns TRUE if nothing needs
+ * to be emitted for blk: no instructions, and a
+ * jump without phi copies
+ */
+static int isEmpty( Gen * g, IrBlock * blk )
+{ return (blk->first == NULL) && (blk->term == IrJump) && ! needsCopies(g,blk); }
+
+/* a set of candidates for a home, one bit each */
+typedef unsigned * ValSet;
+
+#define member(s,v) (((s)[(v)/32] >> ((v)%32)) & 1)
+#define include(s,v) ((s)[(v)/32] |= 1u << ((v)%32))
+#define exclude(s,v) ((s)[(v)/32] &= ~(1u << ((v)%32)))
+
+/* the state of the assignment of homes */
+typedef struct
+   { Gen * g;
+     int n; /* candidates are numbered 0..n-1 */
+     int words; /* length of each ValSet */
+     int * cand; /* candidate number of each value, -1 if none */
+     IrInst ** val; /* value of each candidate */
+     int * must; /* candidate needs a home: it is used outside
+                    its block, or its group has a phi */
+     ValSet * def; /* defined in each block or by its phi copies */
+     ValSet * in, * out; /* live on entry to and exit from each block */
+     ValSet * conflict; /* candidates live where it is defined, or
+                           where any of its group is defined */
+     int * group; /* candidates sharing a home, as a union-find tree */
+     long * weight; /* estimated uses and definitions of each group */
+     long * bweight; /* estimated executions of each block */
+   } Homes;
+
+/* a phi and one of its operands, which share a
+ * home if their live ranges do not overlap
+ */
+typedef struct
+   { int phi, arg;
+     long weight; /* how often the copy would run */
+   } Pair;
+
+static ValSet newValSet( Homes * h )
+{ h->g->ctx->allocBytes += h->words*sizeof(unsigned);
+  return (ValSet) calloc(h->words,sizeof(unsigned));
+}
+
+/* Function blockWeight estimates the number of
+ * times blk is executed: ten times as often in
+ * each enclosing repeat loop
+ */
+static long blockWeight( IrBlock * blk )
+{ long w = 1;
+  int d;
+  for (d=0;(d < blk->depth) && (w < MAXWEIGHT);d++) w *= 10;
+  return w;
+}
+
+/* Function edgeCount returns the number of
+ * times the profile says control went from p to
+ * its successor s, -1 if it does not tell; count
+ * is what is known of the executions of each block
+ */
+static long edgeCount( Context * ctx, long * count, IrBlock * p, IrBlock * s )
+{ long n, ntrue;
+  if (p->term == IrJump) return count[p->id];
+  if ((p->term != IrBranch) || (p->succ[0] == p->succ[1]) ||
+      ! siteCounts(ctx,p->site,&n,&ntrue))
+    return -1;
+  return s == p->succ[p->siteTrue] ? ntrue : n-ntrue;
+}
+
+/* Procedure weighBlocks estimates how often each
+ * block is executed: from the profile, where the
+ * counts of the tests reach it, otherwise by its
+ * loop depth
+ */
+// 有剖析数据时从入口（执行一次）出发，沿着已知次数的边传播：
+// 条件跳转的两条出边按真假次数分开，所有入边次数都已知的块就是它们的和
+static void weighBlocks( Homes * h )
+{ IrProg * ir = h->g->ir;
+  Context * ctx = h->g->ctx;
+  long * count = h->bweight;
+  long n, ntrue, sum, e;
+  int b, k, changed;
+  for (b=0;b<ir->nblocks;b++) count[b] = -1;
+  if (ctx->profile != NULL)
+  { count[0] = 1;
+    for (b=0;b<ir->nblocks;b++)
+      if ((ir->block[b]->term == IrBranch) &&
+          siteCounts(ctx,ir->block[b]->site,&n,&ntrue))
+        count[b] = n;
+    do
+    { changed = FALSE;
+      for (b=1;b<ir->nblocks;b++)
+      { IrBlock * blk = ir->block[b];
+        if (count[b] >= 0) continue;
+        for (k=0, sum=0;(k < blk->npreds) && (sum >= 0);k++)
+          sum = ((e = edgeCount(ctx,count,blk->pred[k],blk)) < 0) ? -1 : sum+e;
+        if ((sum >= 0) && (blk->npreds > 0))
+        { count[b] = sum;
+          changed = TRUE;
+        }
+      }
+    } while (changed);
+  }
+  for (b=0;b<ir->nblocks;b++)
+    if (count[b] < 0) count[b] = blockWeight(ir->block[b]);
+}
+
+/* Function candOf returns the candidate number
+ * of value v, -1 if it has none
+ */
+static int candOf( Homes * h, IrInst * v )
+{ return v->op == IrConst ? -1 : h->cand[v->id]; }
+
+/* Function findGroup returns the candidate
+ * representing the group of c
+ */
+static int findGroup( Homes * h, int c )
+{ while (h->group[c] != c)
+  { h->group[c] = h->group[h->group[c]];
+    c = h->group[c];
+  }
+  return c;
+}
+
+/* Procedure findCands numbers the candidates for
+ * a home: the values used outside their block,
+ * including every phi, and the operands of phis
+ * defined on the edge they come in by, which may
+ * share the home of the phi
+ */
+static void findCands( Homes * h )
+{ IrProg * ir = h->g->ir;
+  int * need = (int *) malloc((ir->nvalues+1)*sizeof(int));
+  int b, k, c;
+  IrInst * i;
+  for (k=0;k<ir->nvalues;k++) need[k] = -1;
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b];
+    for (i=blk->first;i != NULL;i=i->next)
+      if (i->op == IrPhi)
+      { need[i->id] = TRUE;
+        for (k=0;k<blk->npreds;k++)
+          if ((i->phiArg[k]->op != IrConst) && (i->phiArg[k] != i))
+          { if (i->phiArg[k]->block != blk->pred[k])
+              need[i->phiArg[k]->id] = TRUE;
+            else if (need[i->phiArg[k]->id] < 0)
+              need[i->phiArg[k]->id] = FALSE;
+          }
+      }
+      else
+        for (k=0;k<2;k++)
+          if ((i->arg[k] != NULL) && (i->arg[k]->op != IrConst) &&
+              (i->arg[k]->block != blk))
+            need[i->arg[k]->id] = TRUE;
+    if (blk->term == IrBranch)
+      for (k=0;k<2;k++)
+        if ((blk->cond[k]->op != IrConst) && (blk->cond[k]->block != blk))
+          need[blk->cond[k]->id] = TRUE;
+  }
+  h->n = 0;
+  for (k=0;k<ir->nvalues;k++) h->cand[k] = -1;
+  for (b=0;b<ir->nblocks;b++)
+    for (i=ir->block[b]->first;i != NULL;i=i->next)
+      if (need[i->id] >= 0)
+      { h->cand[i->id] = c = h->n++;
+        h->val[c] = i;
+        h->must[c] = need[i->id];
+      }
+  free(need);
+}
+
+/* Procedure scanBlock finds the candidates
+ * block b uses before defining them and those
+ * it defines; the phi copies on its outgoing
+ * jump use the operands of the phis and define
+ * the phis
+ */
+static void scanBlock( Homes * h, int b, ValSet use )
+{ IrBlock * blk = h->g->ir->block[b], * succ = blk->succ[0];
+  ValSet def = h->def[b];
+  IrInst * i;
+  int k, c;
+  for (i=blk->first;i != NULL;i=i->next)
+  { if (i->op == IrPhi) continue; /* defined by the copies */
+    for (k=0;k<2;k++)
+      if ((i->arg[k] != NULL) && ((c = candOf(h,i->arg[k])) >= 0) &&
+          ! member(def,c))
+        include(use,c);
+    if ((c = candOf(h,i)) >= 0) include(def,c);
+  }
+  if (blk->term == IrBranch)
+  { for (k=0;k<2;k++)
+      if (((c = candOf(h,blk->cond[k])) >= 0) && ! member(def,c))
+        include(use,c);
+  }
+  else if ((blk->term == IrJump) && hasPhis(succ))
+  { k = predIndex(succ,blk);
+    for (i=succ->first;(i != NULL) && (i->op == IrPhi);i=i->next)
+      if ((i->phiArg[k] != i) && ((c = candOf(h,i->phiArg[k])) >= 0) &&
+          ! member(def,c))
+        include(use,c);
+    for (i=succ->first;(i != NULL) && (i->op == IrPhi);i=i->next)
+      include(def,h->cand[i->id]);
+  }
+}
+
+/* Procedure findLive computes the candidates
+ * live on entry to and exit from each block
+ */
+static void findLive( Homes * h )
+{ IrProg * ir = h->g->ir;
+  ValSet * use = (ValSet *) malloc(ir->nblocks*sizeof(ValSet));
+  int b, k, w, changed;
+  for (b=0;b<ir->nblocks;b++)
+  { use[b] = newValSet(h);
+    scanBlock(h,b,use[b]);
+  }
+  do
+  { changed = FALSE;
+    for (b=ir->nblocks-1;b>=0;b--)
+    { IrBlock * blk = ir->block[b];
+      int nsucc = blk->term == IrBranch ? 2 : blk->term == IrJump ? 1 : 0;
+      for (k=0;k<nsucc;k++)
+        for (w=0;w<h->words;w++)
+          h->out[b][w] |= h->in[blk->succ[k]->id][w];
+      for (w=0;w<h->words;w++)
+      { unsigned in = use[b][w] | (h->out[b][w] & ~h->def[b][w]);
+        if (in != h->in[b][w]) changed = TRUE;
+        h->in[b][w] = in;
+      }
+    }
+  } while (changed);
+  for (b=0;b<ir->nblocks;b++) free(use[b]);
+  free(use);
+}
+
+/* Procedure defineCand records that candidate c
+ * is defined where the candidates in live are
+ * live
+ */
+static void defineCand( Homes * h, int c, ValSet live, long w )
+{ int x;
+  h->weight[c] += w;
+  for (x=0;x<h->n;x++)
+    if ((x != c) && member(live,x))
+    { include(h->conflict[c],x);
+      include(h->conflict[x],c);
+    }
+}
+
+/* Procedure useCand records a use of value v
+ * where live are live
+ */
+static void useCand( Homes * h, IrInst * v, ValSet live, long w )
+{ int c = candOf(h,v);
+  if (c < 0) return;
+  h->weight[c] += w;
+  include(live,c);
+}
+
+/* Procedure findConflicts walks each block
+ * backwards from its exit, recording which
+ * candidates each definition conflicts with and
+ * how often each candidate is used; the phi
+ * copies weigh nothing, since coalescing removes
+ * most of them
+ */
+// SSA形式下两个值冲突当且仅当一个在另一个定义处活跃；
+// phi在前驱块末尾的复制处定义，同一处的几个phi互相冲突，
+// 复制的源值如果在复制后不再活跃，就不和phi冲突，可以共用一个家
+static void findConflicts( Homes * h )
+{ IrProg * ir = h->g->ir;
+  ValSet live = newValSet(h);
+  int b, k, c;
+  IrInst * i, * p;
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b], * succ = blk->succ[0];
+    long w = h->bweight[b];
+    memcpy(live,h->out[b],h->words*sizeof(unsigned));
+    if ((blk->term == IrJump) && hasPhis(succ))
+    { k = predIndex(succ,blk);
+      for (p=succ->first;(p != NULL) && (p->op == IrPhi);p=p->next)
+        include(live,h->cand[p->id]);
+      for (p=succ->first;(p != NULL) && (p->op == IrPhi);p=p->next)
+        defineCand(h,h->cand[p->id],live,0);
+      for (p=succ->first;(p != NULL) && (p->op == IrPhi);p=p->next)
+        exclude(live,h->cand[p->id]);
+      for (p=succ->first;(p != NULL) && (p->op == IrPhi);p=p->next)
+        if (p->phiArg[k] != p) useCand(h,p->phiArg[k],live,0);
+    }
+    else if (blk->term == IrBranch)
+    { useCand(h,blk->cond[0],live,w);
+      useCand(h,blk->cond[1],live,w);
+    }
+    for (i=blk->last;(i != NULL) && (i->op != IrPhi);i=i->prev)
+    { if ((c = candOf(h,i)) >= 0)
+      { defineCand(h,c,live,w);
+        exclude(live,c);
+      }
+      if (i->arg[0] != NULL) useCand(h,i->arg[0],live,w);
+      if (i->arg[1] != NULL) useCand(h,i->arg[1],live,w);
+    }
+  }
+  free(live);
+}
+
+static int pairCmp( const void * a, const void * b )
+{ const Pair * x = (const Pair *) a;
+  const Pair * y = (const Pair *) b;
+  if (x->weight != y->weight) return x->weight < y->weight ? 1 : -1;
+  if (x->phi != y->phi) return x->phi - y->phi; /* qsort is not stable */
+  return x->arg - y->arg;
+}
+
+/* Procedure coalesce puts phis in the group of
+ * their operands where the groups do not
+ * conflict, the copies run most often first, so
+ * that the copies are not needed
+ */
+static void coalesce( Homes * h )
+{ IrProg * ir = h->g->ir;
+  Pair * pair = NULL;
+  int npairs = 0, psize = 0, b, k, c, x, gphi, garg;
+  IrInst * p;
+  for (b=0;b<ir->nblocks;b++)
+    for (p=ir->block[b]->first;(p != NULL) && (p->op == IrPhi);p=p->next)
+      for (k=0;k<ir->block[b]->npreds;k++)
+        if ((p->phiArg[k] != p) && (candOf(h,p->phiArg[k]) >= 0))
+        { if (npairs >= psize)
+          { psize = psize ? 2*psize : 64;
+            pair = (Pair *) realloc(pair,psize*sizeof(Pair));
+          }
+          pair[npairs].phi = h->cand[p->id];
+          pair[npairs].arg = h->cand[p->phiArg[k]->id];
+          pair[npairs].weight = h->bweight[ir->block[b]->pred[k]->id];
+          npairs++;
+        }
+  if (npairs > 0) qsort(pair,npairs,sizeof(Pair),pairCmp);
+  for (k=0;k<npairs;k++)
+  { gphi = findGroup(h,pair[k].phi);
+    garg = findGroup(h,pair[k].arg);
+    if (gphi == garg) continue;
+    for (c=0;c<h->n;c++)
+      if ((findGroup(h,c) == garg) && member(h->conflict[gphi],c)) break;
+    if (c < h->n) continue;
+    h->group[garg] = gphi;
+    h->weight[gphi] += h->weight[garg];
+    h->must[gphi] = TRUE;
+    for (x=0;x<h->words;x++) h->conflict[gphi][x] |= h->conflict[garg][x];
+  }
+  free(pair);
+}
+
+/* Procedure assignHomes gives a home to the
+ * values used outside their block: the groups
+ * used most, by the profile if there is one,
+ * get registers tmpFirst..tmpLast,
+ * different ones if they conflict, the others a
+ * gp location. It sets the registers busy in
+ * each block in g->mask
+ */
+// 寄存器0和1总是留给块内的值；一个块里活跃过的家的寄存器整块都不给块内的值用
+static void assignHomes( Gen * g )
+{ IrProg * ir = g->ir;
+  Homes h;
+  int b, c, x, r, best, taken, nslots = 0;
+  int * reg;
+  h.g = g;
+  h.cand = (int *) malloc((ir->nvalues+1)*sizeof(int));
+  h.must = (int *) malloc((ir->nvalues+1)*sizeof(int));
+  h.val = (IrInst **) malloc((ir->nvalues+1)*sizeof(IrInst *));
+  findCands(&h);
+  h.words = h.n/32 + 1;
+  h.def = (ValSet *) malloc(ir->nblocks*sizeof(ValSet));
+  h.in = (ValSet *) malloc(ir->nblocks*sizeof(ValSet));
+  h.out = (ValSet *) malloc(ir->nblocks*sizeof(ValSet));
+  for (b=0;b<ir->nblocks;b++)
+  { h.def[b] = newValSet(&h);
+    h.in[b] = newValSet(&h);
+    h.out[b] = newValSet(&h);
+  }
+  h.conflict = (ValSet *) malloc((h.n+1)*sizeof(ValSet));
+  h.group = (int *) malloc((h.n+1)*sizeof(int));
+  h.weight = (long *) calloc(h.n+1,sizeof(long));
+  h.bweight = (long *) malloc(ir->nblocks*sizeof(long));
+  reg = (int *) malloc((h.n+1)*sizeof(int));
+  for (c=0;c<h.n;c++)
+  { h.conflict[c] = newValSet(&h);
+    h.group[c] = c;
+  }
+  weighBlocks(&h);
+  findLive(&h);
+  findConflicts(&h);
+  coalesce(&h);
+  /* registers for the heaviest groups first */
+  for (c=0;c<h.n;c++)
+    reg[c] = ((findGroup(&h,c) == c) && h.must[c]) ? NREGS : -1;
+  for (;;)
+  { best = -1;
+    for (c=0;c<h.n;c++)
+      if ((reg[c] == NREGS) && ((best < 0) || (h.weight[c] > h.weight[best])))
+        best = c;
+    if (best < 0) break;
+    taken = 0;
+    for (x=0;x<h.n;x++)
+      if (member(h.conflict[best],x) && (reg[findGroup(&h,x)] >= 0) &&
+          (reg[findGroup(&h,x)] < NREGS))
+        taken |= 1 << reg[findGroup(&h,x)];
+    for (r=tmpLast;(r >= tmpFirst) && (taken & (1 << r));r--) ;
+    reg[best] = (r >= tmpFirst) ? r : -1;
+    if (r < tmpFirst) g->slot[h.val[best]->id] = nslots++;
+  }
+  /* the home of each value */
+  for (c=0;c<h.n;c++)
+  { IrInst * v = h.val[c];
+    int root = findGroup(&h,c);
+    if (! h.must[root]) continue; /* only used on its block */
+    g->home[v->id] = h.val[root]->id;
+    g->hreg[v->id] = reg[root];
+    if (reg[root] < 0) g->slot[v->id] = g->slot[h.val[root]->id];
+  }
+  for (b=0;b<ir->nblocks;b++)
+  { g->mask[b] = 0;
+    for (c=0;c<h.n;c++)
+      if ((member(h.in[b],c) || member(h.out[b],c) || member(h.def[b],c)) &&
+          (g->hreg[h.val[c]->id] >= 0))
+        g->mask[b] |= 1 << g->hreg[h.val[c]->id];
+    free(h.def[b]);
+    free(h.in[b]);
+    free(h.out[b]);
+  }
+  for (c=0;c<h.n;c++) free(h.conflict[c]);
+  free(h.def);
+  free(h.in);
+  free(h.out);
+  free(h.conflict);
+  free(h.group);
+  free(h.weight);
+  free(h.bweight);
+  free(h.cand);
+  free(h.must);
+  free(h.val);
+  free(reg);
+}
+
+/* Procedure genProgram emits the TM code for ir */
+static void genProgram( Context * ctx, IrProg * ir )
+{ Gen g;
+  int b, k, n;
+  IrInst * i;
+  g.ctx = ctx;
+  g.ir = ir;
+  n = ir->nvalues;
+  g.home = (int *) malloc(n*sizeof(int));
+  g.hreg = (int *) malloc(n*sizeof(int));
+  g.slot = (int *) malloc(n*sizeof(int));
+  g.reg = (int *) malloc(n*sizeof(int));
+  g.spill = (int *) malloc(n*sizeof(int));
+  g.uses = (int *) calloc(n,sizeof(int));
+  g.start = (int *) malloc(ir->nblocks*sizeof(int));
+  g.target = (IrBlock **) malloc(ir->nblocks*sizeof(IrBlock *));
+  g.mask = (int *) malloc(ir->nblocks*sizeof(int));
+  g.fix = NULL;
+  g.nfix = g.fsize = 0;
+  for (k=0;k<n;k++)
+  { g.home[k] = -1; g.hreg[k] = -1; g.slot[k] = -1;
+    g.reg[k] = -1; g.spill[k] = 1;
+  }
+  for (k=0;k<NREGS;k++)
+  { g.regVal[k] = NULL; g.pinned[k] = FALSE; g.busy[k] = FALSE; }
+  assignHomes(&g);
+  /* jumps to empty blocks go on to their targets */
+  for (b=ir->nblocks-1;b>=0;b--)
+  { IrBlock * t = ir->block[b];
+    for (k=0;(k < ir->nblocks) && isEmpty(&g,t);k++) t = t->succ[0];
+    g.target[b] = t;
+    g.start[b] = -1;
+  }
+  for (b=0;b<ir->nblocks;b++)
+  { IrBlock * blk = ir->block[b];
+    IrBlock * next = NULL;
+    if (isEmpty(&g,blk) && (g.target[b] != blk)) continue;
+    for (k=b+1;k<ir->nblocks;k++)
+      if (! isEmpty(&g,ir->block[k]) || (g.target[k] == ir->block[k]))
+      { next = ir->block[k];
+        break;
+      }
+    g.start[b] = emitSkip(ctx,0);
+    if (TraceCode) emitComment(ctx,"ir: block");
+    for (k=0;k<NREGS;k++) freeReg(&g,k); // 进入块时寄存器中只有家
+    for (k=0, g.nfree=0;k<NREGS;k++)
+    { g.busy[k] = (g.mask[b] >> k) & 1;
+      if (! g.busy[k]) g.nfree++;
+    }
+    ctx->tmpOffset = 0;
+    countUses(&g,blk);
+    for (i=blk->first;i != NULL;i=i->next) genInst(&g,i);
+    switch (blk->term)
+    { case IrJump:
+        if (hasPhis(blk->succ[0])) genCopies(&g,blk,blk->succ[0]);
+        if (g.target[blk->succ[0]->id] != next)
+          genJump(&g,opLDA,pc,blk->succ[0]);
+        break;
+      case IrBranch:
+        genBranch(&g,blk,next);
+        break;
+      default:
+        emitRO(ctx,opHALT,0,0,0,"ir: halt");
+        break;
+    }
+  }
+  /* backpatch the forward jumps */
+  for (k=0;k<g.nfix;k++)
+  { emitBackup(ctx,g.fix[k].loc);
+    emitRM_Abs(ctx,g.fix[k].op,g.fix[k].r,g.start[g.fix[k].target->id],"ir: jump");
+    emitRestore(ctx);
+  }
+  free(g.home);
+  free(g.hreg);
+  free(g.slot);
+  free(g.reg);
+  free(g.spill);
+  free(g.uses);
+  free(g.start);
+  free(g.target);
+  free(g.mask);
+  free(g.fix);
+}
+
+void irCodeGen( Context * ctx, TreeNode * syntaxTree )
+{ IrProg * ir = irLower(ctx,syntaxTree);
+  if (TraceIR) irDump(ir,ctx->listing,"after lowering");
+  irHoist(ir);
+  if (TraceIR) irDump(ir,ctx->listing,"after loop invariant code motion");
+  irValueNumber(ir);
+  if (TraceIR) irDump(ir,ctx->listing,"after value numbering");
+  irReduce(ir);
+  if (TraceIR) irDump(ir,ctx->listing,"after strength reduction");
+  irValueNumber(ir);
+  if (TraceIR) irDump(ir,ctx->listing,"after value numbering");
+  irDeadCode(ir);
+  if (TraceIR) irDump(ir,ctx->listing,"after dead code elimination");
+  genProgram(ctx,ir);
+  irFree(ir);
+}
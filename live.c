@@ -0,0 +1,175 @@
+/****************************************************/
+/* File: live.c                                     */
+/* Liveness analysis and dead store elimination    */
+/* on the syntax tree for the TINY compiler         */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "util.h"
+#include "fold.h"
+#include "live.h"
+
+// 活跃变量分析从程序末尾向前进行：语句序列倒着处理，
+// if的两个分支分别分析后在入口处取并集，
+// repeat的回边要反复迭代直到循环入口的活跃集合不再变化。
+// 外层循环每迭代一次都要重新分析内层循环，所以记住每个repeat上次的结果，
+// 下次从它开始迭代（循环后的活跃集合只增不减，结果不变），
+// 否则嵌套循环的分析时间随嵌套深度指数增长。
+// 这里算的是"强活跃"：被删除的赋值语句用到的变量不算被使用，
+// 所以只为无用变量服务的一串赋值可以一次全部删掉
+
+/* a set of variables, one bit per symbol
+ * table handle
+ */
+typedef unsigned * VarSet;
+
+/* the state of the analysis */
+typedef struct
+   { Context * ctx;
+     int words; /* length of each VarSet */
+     VarSet * top; /* live at the top of the body of each repeat
+                      by site, NULL until it is analyzed */
+   } Live;
+
+static VarSet newSet( Live * l )
+{ l->ctx->allocBytes += l->words*sizeof(unsigned);
+  return (VarSet) calloc(l->words,sizeof(unsigned));
+}
+
+static void copySet( Live * l, VarSet to, VarSet from )
+{ memcpy(to,from,l->words*sizeof(unsigned)); }
+
+static void unionSet( Live * l, VarSet to, VarSet from )
+{ int i;
+  for (i=0;i<l->words;i++) to[i] |= from[i];
+}
+
+static int sameSet( Live * l, VarSet a, VarSet b )
+{ return memcmp(a,b,l->words*sizeof(unsigned)) == 0; }
+
+#define member(s,v) (((s)[(v)/32] >> ((v)%32)) & 1)
+#define include(s,v) ((s)[(v)/32] |= 1u << ((v)%32))
+#define exclude(s,v) ((s)[(v)/32] &= ~(1u << ((v)%32)))
+
+/* hasSite is TRUE if repeat loop s has a site */
+#define hasSite(l,s) (((s)->site >= 0) && ((s)->site < (l)->ctx->nsites))
+
+/* Function loopTop returns the variables found
+ * live at the top of the body of repeat loop s
+ * so far, kept from one analysis of s to the
+ * next unless s has no site
+ */
+static VarSet loopTop( Live * l, TreeNode * s )
+{ if (! hasSite(l,s)) return newSet(l);
+  if (l->top[s->site] == NULL) l->top[s->site] = newSet(l);
+  return l->top[s->site];
+}
+
+/* Procedure useExp adds the variables read by
+ * expression t to live
+ */
+static void useExp( VarSet live, TreeNode * t )
+{ if (t == NULL) return;
+  if (t->kind.exp == IdK) include(live,t->symbol);
+  else if (t->kind.exp == OpK)
+  { useExp(live,t->child[0]);
+    useExp(live,t->child[1]);
+  }
+}
+
+/* Function liveStmts computes the variables live
+ * before the statement sequence t from those live
+ * after it, replacing live by the result. If
+ * remove is TRUE, dead assignments are removed;
+ * the new sequence is returned
+ */
+static TreeNode * liveStmts( Live * l, TreeNode * t, VarSet live, int remove )
+{ TreeNode ** stmt;
+  TreeNode * head = NULL;
+  VarSet other, end, top;
+  int n = 0, k;
+  for (head=t;head != NULL;head=head->sibling) n++;
+  if (n == 0) return NULL;
+  stmt = (TreeNode **) malloc(n*sizeof(TreeNode *));
+  for (k=0;t != NULL;t=t->sibling) stmt[k++] = t;
+  for (k=n-1;k>=0;k--) // 倒序处理兄弟结点
+  { TreeNode * s = stmt[k];
+    switch (s->kind.stmt)
+    { case IfK:
+        other = newSet(l);
+        copySet(l,other,live);
+        s->child[1] = liveStmts(l,s->child[1],live,remove);
+        s->child[2] = liveStmts(l,s->child[2],other,remove);
+        unionSet(l,live,other);
+        useExp(live,s->child[0]);
+        free(other);
+        break;
+      case RepeatK:
+        /* end = live after the body: after the loop,
+           in the test, or again at the top of the body */
+        end = newSet(l);
+        top = loopTop(l,s);
+        other = newSet(l);
+        for (;;) // 从上次的结果（或空集）开始迭代，集合只增不减，必然收敛
+        { copySet(l,end,live);
+          useExp(end,s->child[1]);
+          unionSet(l,end,top);
+          copySet(l,other,end);
+          liveStmts(l,s->child[0],other,FALSE);
+          if (sameSet(l,other,top)) break;
+          copySet(l,top,other);
+        }
+        s->child[0] = liveStmts(l,s->child[0],end,remove);
+        copySet(l,live,end); /* now live at the top of the body */
+        free(end);
+        if (! hasSite(l,s)) free(top);
+        free(other);
+        break;
+      case AssignK:
+        if (! member(live,s->symbol) && ! mayTrap(s->child[0]))
+        { if (remove)
+          { s->sibling = NULL;
+            freeTree(s);
+            stmt[k] = NULL;
+          }
+          break;
+        }
+        exclude(live,s->symbol);
+        useExp(live,s->child[0]);
+        break;
+      case ReadK: /* the input is consumed even if x is dead */
+        exclude(live,s->symbol);
+        break;
+      case WriteK:
+        useExp(live,s->child[0]);
+        break;
+      default:
+        break;
+    }
+  }
+  head = NULL;
+  for (k=n-1;k>=0;k--)
+    if (stmt[k] != NULL)
+    { stmt[k]->sibling = head;
+      head = stmt[k];
+    }
+  free(stmt);
+  return head;
+}
+
+TreeNode * removeDeadStores( Context * ctx, TreeNode * syntaxTree )
+{ Live l;
+  VarSet live;
+  int i;
+  l.ctx = ctx;
+  l.words = ctx->location/32 + 1;
+  l.top = (VarSet *) calloc(ctx->nsites+1,sizeof(VarSet));
+  ctx->allocBytes += (ctx->nsites+1)*sizeof(VarSet);
+  live = newSet(&l); /* nothing is live when the program ends */
+  syntaxTree = liveStmts(&l,syntaxTree,live,TRUE);
+  free(live);
+  for (i=0;i<ctx->nsites;i++) free(l.top[i]);
+  free(l.top);
+  return syntaxTree;
+}
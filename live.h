@@ -0,0 +1,20 @@
+/****************************************************/
+/* File: live.h                                     */
+/* Liveness analysis and dead store elimination    */
+/* on the syntax tree for the TINY compiler         */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _LIVE_H_
+#define _LIVE_H_
+
+/* Function removeDeadStores removes from the type
+ * checked syntax tree every assignment whose
+ * variable is not read before it is assigned
+ * again or the program ends, unless evaluating
+ * the expression may stop the machine. It returns
+ * the new tree; removed nodes are freed
+ */
+TreeNode * removeDeadStores(Context * ctx, TreeNode * syntaxTree);
+
+#endif
@@ -6,6 +6,7 @@
 /****************************************************/
 
 #include "globals.h"
+#include <pthread.h>
 
 /* set NO_PARSE to TRUE to get a scanner-only compiler */
 #define NO_PARSE FALSE
@@ -19,25 +20,26 @@
 
 // scan在嵌套结构上比较特殊，是被parse所调用
 #include "util.h"
-#if NO_PARSE
 #include "scan.h"
-#else
+#include "report.h"
+#if !NO_PARSE
 #include "parse.h"
 #if !NO_ANALYZE
 #include "analyze.h"
 #if !NO_CODE
+#include "fold.h"
+#include "live.h"
+#include "peval.h"
+#include "unroll.h"
+#include "profile.h"
 #include "cgen.h"
+#include "interp.h"
 #endif
 #endif
 #endif
 
-// 下面这些变量中都在globals.h中被extern公开，作为全局变量被其他文件使用
-
-/* allocate global variables */
-int lineno = 0;
-FILE * source;
-FILE * listing;
-FILE * code;
+// 下面这些跟踪开关在globals.h中被extern公开，编译期间只读，
+// 所以可以被多个线程中的编译共享；其余状态都在Context中
 
 /* allocate and set tracing flags */
 int EchoSource = TRUE; // 跟踪信息由scan打印
@@ -45,65 +47,464 @@ int TraceScan = TRUE; // 跟踪信息由scan打印
 int TraceParse = TRUE; // 由main打印
 int TraceAnalyze = TRUE;
 int TraceCode = TRUE;
+int TraceIR = TRUE;
 
-int Error = FALSE;
+/* allocate and set the optimization level */
+int OptLevel = 1;
+int UnrollFactor = 4;
+long EvalBudget = 1000000;
 
-main( int argc, char * argv[] )
-{ TreeNode * syntaxTree;
-  char pgm[120]; /* source code file name */
-  if (argc != 2) // 检查参数个数
-    { fprintf(stderr,"usage: %s <filename>\n",argv[0]);
-      exit(1);
-    }
-  strcpy(pgm,argv[1]) ;
-  if (strchr (pgm, '.') == NULL) // 自动检测补全后缀
-     strcat(pgm,".tny");
-  source = fopen(pgm,"r");
-  if (source==NULL)
-  { fprintf(stderr,"File %s not found\n",pgm);
-    exit(1);
-  }
+/* MAXUNROLL = the largest factor for -funroll */
+#define MAXUNROLL 16
+
+/* timeReport = TRUE prints a per-phase time report
+ * for each compilation (-ftime-report); reportJSON
+ * selects JSON instead of text (-ftime-report=json)
+ */
+static int timeReport = FALSE;
+static int reportJSON = FALSE;
+
+/* profileUse = TRUE makes each compilation read
+ * the profile written by tm -p for the program
+ * (file extension .prof) and use it to lay out
+ * if statements, choose the variables kept in
+ * registers and leave cold loops rolled
+ * (-fprofile-use)
+ */
+static int profileUse = FALSE;
+
+/* runMode = TRUE runs each program on the bytecode
+ * interpreter (interp.h) instead of writing a TM
+ * code file (--run)
+ */
+static int runMode = FALSE;
+
+/* scanThread = TRUE scans each program on a
+ * thread of its own, ahead of the parser
+ * (-fscan-thread)
+ */
+static int scanThread = FALSE;
+
+/* lexThreads = the most threads lexing a large
+ * source in parallel (-flex-threads=<n>)
+ */
+static int lexThreads = 1;
+
+/* MAXHEADER = the maximum length of a request
+ * header line in server mode
+ */
+#define MAXHEADER 256
 
-  // 输出导至标准输出
-  listing = stdout; /* send listing to screen */
-  fprintf(listing,"\nTINY COMPILATION: %s\n",pgm);
+/* Function codeFileName returns the name of the
+ * file for program pgm with extension ext (".tm"
+ * for the TM code file)
+ */
+static char * codeFileName(char * pgm, char * ext)
+{ char * codefile;
+  // 组建输出文件的文件名
+  int fnlen = strcspn(pgm,".");
+  codefile = (char *) calloc(fnlen+strlen(ext)+1, sizeof(char));
+  strncpy(codefile,pgm,fnlen);
+  strcat(codefile,ext);
+  return codefile;
+}
+
+/* Function frontEnd scans, parses, analyzes and
+ * simplifies the program already opened as
+ * ctx->source, with the listing going to
+ * ctx->listing. pgm is the
+ * program name printed in the listing. It returns
+ * the syntax tree (NULL for a scanner-only compiler);
+ * ctx->Error is set if any phase reported an error
+ */
+static TreeNode * frontEnd(Context * ctx, char * pgm)
+{ TreeNode * syntaxTree = NULL;
+  resetScanner(ctx);
+  fprintf(ctx->listing,"\nTINY COMPILATION: %s\n",pgm);
 #if NO_PARSE
-  while (getToken()!=ENDFILE); // 关键函数1
+  if (! scanParallel(ctx,lexThreads) && scanThread) startScanner(ctx);
+  while (getToken(ctx)!=ENDFILE); // 关键函数1
+  stopScanner(ctx);
 #else
   // parse()自己调用了getToken()
-  syntaxTree = parse(); // 关键函数2
+  phaseStart(ctx,ParsePhase);
+  if (! scanParallel(ctx,lexThreads) && scanThread) startScanner(ctx);
+  syntaxTree = parse(ctx); // 关键函数2
+  stopScanner(ctx);
+  phaseStop(ctx,ParsePhase);
   if (TraceParse) {
-    fprintf(listing,"\nSyntax tree:\n");
-    printTree(syntaxTree);
+    fprintf(ctx->listing,"\nSyntax tree:\n");
+    printTree(ctx,syntaxTree);
   }
 #if !NO_ANALYZE
-  if (! Error) // Error是一个全局变量，parse()会将状态写在这里
-  { if (TraceAnalyze) fprintf(listing,"\nBuilding Symbol Table...\n");
-    buildSymtab(syntaxTree); // 关键函数3
-    if (TraceAnalyze) fprintf(listing,"\nChecking Types...\n");
-    typeCheck(syntaxTree); // 关键函数4
-    if (TraceAnalyze) fprintf(listing,"\nType Checking Finished\n");
-  } // 上面这两个函数可以看成一个整体，输入是一棵语法树，输出是一颗带标记的语法树，和一张符号表
+  if (! ctx->Error) // parse()会将错误状态写在ctx->Error
+  { if (TraceAnalyze) fprintf(ctx->listing,"\nBuilding Symbol Table...\n");
+    phaseStart(ctx,AnalyzePhase);
+    analyze(ctx,syntaxTree); // 关键函数3：建符号表和类型检查合在一次遍历中
+    phaseStop(ctx,AnalyzePhase);
 #if !NO_CODE
-  if (! Error) // 又是一次错误检查
-  { char * codefile;
-    // 组建输出文件的文件名
-    int fnlen = strcspn(pgm,".");
-    codefile = (char *) calloc(fnlen+4, sizeof(char));
-    strncpy(codefile,pgm,fnlen);
-    strcat(codefile,".tm");
-    code = fopen(codefile,"w");
-    if (code == NULL)
-    { printf("Unable to open %s\n",codefile);
-      exit(1);
+    numberSites(ctx,syntaxTree); // 给if/repeat编号，剖析按编号对应回语法树
+    if (! ctx->Error && profileUse && (OptLevel >= 1))
+    { char * profile = codeFileName(pgm,".prof");
+      if (! readProfile(ctx,profile))
+        fprintf(ctx->listing,"Warning: no profile %s\n",profile);
+      free(profile);
+    }
+    if (! ctx->Error && (OptLevel >= 1))
+    { phaseStart(ctx,FoldPhase);
+      syntaxTree = foldTree(ctx,syntaxTree); // 常量折叠和代数化简
+      syntaxTree = evalPrefix(ctx,syntaxTree); // 不依赖输入的开头部分在编译时执行
+      syntaxTree = removeDeadStores(ctx,syntaxTree); // 删除无用的赋值
+      syntaxTree = unrollLoops(ctx,syntaxTree); // 展开计数循环
+      phaseStop(ctx,FoldPhase);
     }
-    codeGen(syntaxTree,codefile); // 关键函数5
-    fclose(code);
-  }
 #endif
+    if (TraceAnalyze) fprintf(ctx->listing,"\nType Checking Finished\n");
+  } // 输入是一棵语法树，输出是一颗带标记的语法树，和一张符号表
 #endif
 #endif
+  return syntaxTree;
+}
+
+/* Function compileFile compiles the source file
+ * named pgm into a TM code file of the same name
+ * with extension .tm, or runs it in run mode,
+ * writing the listing to listing and the time
+ * report (if requested) to reportOut. It returns
+ * FALSE if a file could not be opened, with the
+ * reason left in msg (at least MAXHEADER
+ * characters)
+ */
+static int compileFile(char * pgm, FILE * listing, FILE * reportOut,
+                       char * msg)
+{ TreeNode * syntaxTree;
+  Context * ctx;
+  FILE * source = fopen(pgm,"r");
+  if (source==NULL)
+  { snprintf(msg,MAXHEADER,"File %s not found",pgm);
+    return FALSE;
+  }
+  ctx = newContext(source,listing);
+  if (timeReport) startReport(ctx);
+  syntaxTree = frontEnd(ctx,pgm);
+#if !NO_PARSE && !NO_ANALYZE && !NO_CODE
+  if (! ctx->Error && runMode) // 不经过TM代码文件和tm，直接解释执行
+  { Bytecode bc;
+    phaseStart(ctx,CodePhase);
+    bc = lowerProgram(ctx,syntaxTree);
+    phaseStop(ctx,CodePhase);
+    fflush(listing);
+    runBytecode(bc,stdin,stdout);
+    freeBytecode(bc);
+  }
+  else if (! ctx->Error) // 又是一次错误检查
+  { char * codefile = codeFileName(pgm,".tm");
+    ctx->code = fopen(codefile,"w");
+    if (ctx->code == NULL)
+    { snprintf(msg,MAXHEADER,"Unable to open %s",codefile);
+      free(codefile);
+      freeTree(syntaxTree);
+      freeContext(ctx);
+      fclose(source);
+      return FALSE;
+    }
+    phaseStart(ctx,CodePhase);
+    codeGen(ctx,syntaxTree,codefile); // 关键函数5
+    phaseStop(ctx,CodePhase);
+    fclose(ctx->code);
+    free(codefile);
+  }
+#endif
+  freeTree(syntaxTree);
+  printReport(ctx,pgm,reportOut,reportJSON);
+  freeContext(ctx);
   fclose(source);
-  return 0;
+  return TRUE;
+}
+
+/* Procedure serve runs the compiler as a resident
+ * server reading framed requests from stdin until
+ * end of file. Each request is a header line
+ *
+ *     <name> <length>
+ *
+ * followed by exactly <length> bytes of TINY source.
+ * Each reply is a header line
+ *
+ *     <status> <listing-length> <code-length>
+ *
+ * with status "ok" or "error", followed by the bytes
+ * of the listing and then the bytes of the TM code
+ * (empty if the compilation failed). The time
+ * report, if requested, ends the listing. Every
+ * request gets a fresh compilation context, so the
+ * server may be attached to a socket by the caller
+ */
+static void serve(void)
+{ char header[MAXHEADER];
+  char name[MAXHEADER];
+  long length;
+  while (fgets(header,MAXHEADER,stdin) != NULL)
+  { TreeNode * syntaxTree;
+    Context * ctx;
+    char * text;
+    char * listBuf = NULL, * codeBuf = NULL;
+    size_t listLen = 0, codeLen = 0;
+    int failed;
+    if ((sscanf(header,"%255s %ld",name,&length) != 2) || (length < 0))
+    { fprintf(stderr,"tiny: bad request header: %s",header);
+      exit(1);
+    }
+    text = (char *) malloc(length+1);
+    if ((text == NULL) ||
+        (fread(text,1,length,stdin) != (size_t) length))
+    { fprintf(stderr,"tiny: truncated request %s\n",name);
+      exit(1);
+    }
+    // 源程序和输出都在内存中，不经过文件系统
+    ctx = newContext(fmemopen(text,length,"r"),
+                     open_memstream(&listBuf,&listLen));
+    if (timeReport) startReport(ctx);
+    syntaxTree = frontEnd(ctx,name);
+#if !NO_PARSE && !NO_ANALYZE && !NO_CODE
+    if (! ctx->Error)
+    { char * codefile = codeFileName(name,".tm");
+      ctx->code = open_memstream(&codeBuf,&codeLen);
+      phaseStart(ctx,CodePhase);
+      codeGen(ctx,syntaxTree,codefile);
+      phaseStop(ctx,CodePhase);
+      fclose(ctx->code);
+      free(codefile);
+    }
+#endif
+    failed = ctx->Error;
+    freeTree(syntaxTree);
+    printReport(ctx,name,ctx->listing,reportJSON);
+    fclose(ctx->listing);
+    fclose(ctx->source);
+    freeContext(ctx);
+    printf("%s %lu %lu\n",failed ? "error" : "ok",
+           (unsigned long) listLen,(unsigned long) codeLen);
+    fwrite(listBuf,1,listLen,stdout);
+    if (codeBuf != NULL) fwrite(codeBuf,1,codeLen,stdout);
+    fflush(stdout);
+    free(listBuf);
+    free(codeBuf);
+    free(text);
+  }
+}
+
+/* the state of one file compiled by the
+ * parallel driver
+ */
+typedef struct
+   { char * pgm; /* source code file name */
+     char * listBuf; /* listing collected in memory */
+     size_t listLen;
+     char * reportBuf; /* time report collected in memory */
+     size_t reportLen;
+     int ok; /* FALSE if a file could not be opened */
+     char msg[MAXHEADER]; /* reason when ok is FALSE */
+     int done; /* set once the worker has finished */
+   } Job;
+
+/* the work queue shared by the worker threads:
+ * jobs are handed out in order under lock, and
+ * the main thread waits on doneCond for each job
+ * so that listings appear in command-line order
+ */
+typedef struct
+   { Job * jobs;
+     int njobs;
+     int next; /* index of next job to hand out */
+     pthread_mutex_t lock;
+     pthread_cond_t doneCond;
+   } JobQueue;
+
+/* Procedure worker is the body of each thread
+ * in the parallel driver
+ */
+static void * worker(void * arg)
+{ JobQueue * q = (JobQueue *) arg;
+  for (;;)
+  { Job * job;
+    FILE * listing, * reportOut;
+    pthread_mutex_lock(&q->lock);
+    if (q->next >= q->njobs)
+    { pthread_mutex_unlock(&q->lock);
+      break;
+    }
+    job = &q->jobs[q->next++];
+    pthread_mutex_unlock(&q->lock);
+    // 每个编译都有自己的Context，列表输出先收集在内存中
+    listing = open_memstream(&job->listBuf,&job->listLen);
+    reportOut = open_memstream(&job->reportBuf,&job->reportLen);
+    job->ok = compileFile(job->pgm,listing,reportOut,job->msg);
+    fclose(listing);
+    fclose(reportOut);
+    pthread_mutex_lock(&q->lock);
+    job->done = TRUE;
+    pthread_cond_broadcast(&q->doneCond);
+    pthread_mutex_unlock(&q->lock);
+  }
+  return NULL;
+}
+
+/* Function compileAll compiles the njobs files
+ * in jobs on nthreads worker threads and copies
+ * their listings to stdout in order. It returns
+ * FALSE if any file could not be compiled
+ */
+static int compileAll(Job * jobs, int njobs, int nthreads)
+{ JobQueue q;
+  pthread_t * threads;
+  int i, ok = TRUE;
+  if (nthreads > njobs) nthreads = njobs;
+  q.jobs = jobs;
+  q.njobs = njobs;
+  q.next = 0;
+  pthread_mutex_init(&q.lock,NULL);
+  pthread_cond_init(&q.doneCond,NULL);
+  threads = (pthread_t *) malloc(nthreads*sizeof(pthread_t));
+  for (i=0;i<nthreads;i++)
+    pthread_create(&threads[i],NULL,worker,&q);
+  for (i=0;i<njobs;i++)
+  { pthread_mutex_lock(&q.lock);
+    while (! jobs[i].done)
+      pthread_cond_wait(&q.doneCond,&q.lock);
+    pthread_mutex_unlock(&q.lock);
+    fwrite(jobs[i].listBuf,1,jobs[i].listLen,stdout);
+    free(jobs[i].listBuf);
+    fflush(stdout);
+    fwrite(jobs[i].reportBuf,1,jobs[i].reportLen,stderr);
+    free(jobs[i].reportBuf);
+    if (! jobs[i].ok)
+    { fprintf(stderr,"%s\n",jobs[i].msg);
+      ok = FALSE;
+    }
+  }
+  for (i=0;i<nthreads;i++)
+    pthread_join(threads[i],NULL);
+  free(threads);
+  pthread_mutex_destroy(&q.lock);
+  pthread_cond_destroy(&q.doneCond);
+  return ok;
+}
+
+static void usage(char * prog)
+{ fprintf(stderr,"usage: %s [options] <filename> ...\n",prog);
+  fprintf(stderr,"       %s [options] -server\n",prog);
+  fprintf(stderr,"options:\n");
+  fprintf(stderr,"  -j <threads>         compile files on a pool of threads\n");
+  fprintf(stderr,"  -O<level>            optimization level: 0 none,"
+                 " 1 fold, dead stores and\n");
+  fprintf(stderr,"                       peephole (default),"
+                 " 2 also through the SSA IR\n");
+  fprintf(stderr,"                       (-O0 gives the instructions"
+                 " of the original compiler)\n");
+  fprintf(stderr,"  -q                   turn off all tracing output\n");
+  fprintf(stderr,"  --run                run the program instead of writing"
+                 " TM code\n");
+  fprintf(stderr,"  -fscan-thread        scan on a thread of its own,"
+                 " ahead of the parser\n");
+  fprintf(stderr,"  -flex-threads=<n>    lex a large source on up to n"
+                 " threads (with -q)\n");
+  fprintf(stderr,"  -ftime-report[=json] report time, allocation and sizes"
+                 " per phase\n");
+  fprintf(stderr,"  -fprofile-use        optimize with the profile written"
+                 " by tm -p (.prof)\n");
+  fprintf(stderr,"  -funroll=<n>         copies of the body of an unrolled"
+                 " loop (default 4)\n");
+  fprintf(stderr,"  -feval-budget=<n>    steps for running the program"
+                 " before its first read\n");
+  fprintf(stderr,"                       at compile time (default 1000000,"
+                 " 0 off)\n");
+  exit(1);
+}
+
+main( int argc, char * argv[] )
+{ Job * jobs;
+  int njobs = 0, nthreads = 1;
+  int i, ok, server = FALSE;
+  jobs = (Job *) calloc(argc,sizeof(Job));
+  for (i=1;i<argc;i++) // 检查参数
+  { if (strcmp(argv[i],"-j") == 0)
+    { if ((++i >= argc) || ((nthreads = atoi(argv[i])) < 1))
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i],"-server") == 0)
+      server = TRUE;
+    else if (strcmp(argv[i],"--run") == 0)
+      runMode = TRUE;
+    else if (strcmp(argv[i],"-q") == 0)
+      // 跟踪输出本身会拖慢编译，测量时间时应关掉
+      EchoSource = TraceScan = TraceParse = TraceAnalyze = TraceCode =
+        TraceIR = FALSE;
+    else if ((argv[i][0] == '-') && (argv[i][1] == 'O'))
+    { if (argv[i][2] == '\0') OptLevel = 1; // -O等同于-O1
+      else if (isdigit(argv[i][2]) && (argv[i][3] == '\0'))
+        OptLevel = argv[i][2] - '0';
+      else usage(argv[0]);
+    }
+    else if (strcmp(argv[i],"-ftime-report") == 0)
+      timeReport = TRUE;
+    else if (strcmp(argv[i],"-ftime-report=json") == 0)
+      timeReport = reportJSON = TRUE;
+    else if (strcmp(argv[i],"-fprofile-use") == 0)
+      profileUse = TRUE;
+    else if (strcmp(argv[i],"-fscan-thread") == 0)
+      scanThread = TRUE;
+    else if (strncmp(argv[i],"-flex-threads=",14) == 0)
+    { if ((lexThreads = atoi(argv[i]+14)) < 1) usage(argv[0]);
+    }
+    else if (strncmp(argv[i],"-funroll=",9) == 0)
+    { UnrollFactor = atoi(argv[i]+9);
+      if ((UnrollFactor < 1) || (UnrollFactor > MAXUNROLL)) usage(argv[0]);
+    }
+    else if (strncmp(argv[i],"-feval-budget=",14) == 0)
+    { char * end;
+      EvalBudget = strtol(argv[i]+14,&end,10);
+      if ((end == argv[i]+14) || (*end != '\0') || (EvalBudget < 0))
+        usage(argv[0]);
+    }
+    else if (argv[i][0] == '-')
+      usage(argv[0]);
+    else
+    { char * pgm = (char *) malloc(strlen(argv[i])+5); /* source code file name */
+      strcpy(pgm,argv[i]) ;
+      if (strchr (pgm, '.') == NULL) // 自动检测补全后缀
+         strcat(pgm,".tny");
+      jobs[njobs++].pgm = pgm;
+    }
+  }
+  if (server && runMode)
+    usage(argv[0]);
+  if (server && (njobs == 0))
+  { free(jobs);
+    serve();
+    return 0;
+  }
+  if ((njobs == 0) || server)
+    usage(argv[0]);
+  if (runMode) nthreads = 1; /* the programs share stdin and stdout */
+#ifdef SHARED_PARSER_STATE
+  nthreads = 1; /* the parser and scanner are not reentrant */
+#endif
+
+  if ((njobs == 1) || (nthreads == 1))
+  { ok = TRUE;
+    for (i=0;i<njobs;i++)
+    { char msg[MAXHEADER];
+      // 输出导至标准输出
+      if (! compileFile(jobs[i].pgm,stdout,stderr,msg)) /* send listing to screen */
+      { fprintf(stderr,"%s\n",msg);
+        ok = FALSE;
+      }
+    }
+  }
+  else ok = compileAll(jobs,njobs,nthreads);
+  for (i=0;i<njobs;i++) free(jobs[i].pgm);
+  free(jobs);
+  return ok ? 0 : 1;
 }
 
@@ -10,47 +10,47 @@
 #include "scan.h"
 #include "parse.h"
 
-static TokenType token; /* holds current token */
+// 当前token保存在ctx->token中
 
 /* function prototypes for recursive calls */
 // 11个递归函数
-static TreeNode * stmt_sequence(void);
-static TreeNode * statement(void);
-static TreeNode * if_stmt(void);
-static TreeNode * repeat_stmt(void);
-static TreeNode * assign_stmt(void);
-static TreeNode * read_stmt(void);
-static TreeNode * write_stmt(void);
-static TreeNode * exp(void);
-static TreeNode * simple_exp(void);
-static TreeNode * term(void);
-static TreeNode * factor(void);
+static TreeNode * stmt_sequence(Context * ctx);
+static TreeNode * statement(Context * ctx);
+static TreeNode * if_stmt(Context * ctx);
+static TreeNode * repeat_stmt(Context * ctx);
+static TreeNode * assign_stmt(Context * ctx);
+static TreeNode * read_stmt(Context * ctx);
+static TreeNode * write_stmt(Context * ctx);
+static TreeNode * exp(Context * ctx);
+static TreeNode * simple_exp(Context * ctx);
+static TreeNode * term(Context * ctx);
+static TreeNode * factor(Context * ctx);
 
 // 2个辅助函数
-static void syntaxError(char * message)
-{ fprintf(listing,"\n>>> ");
-  fprintf(listing,"Syntax error at line %d: %s",lineno,message);
-  Error = TRUE;
+static void syntaxError(Context * ctx, char * message)
+{ fprintf(ctx->listing,"\n>>> ");
+  fprintf(ctx->listing,"Syntax error at line %d: %s",ctx->lineno,message);
+  ctx->Error = TRUE;
 }
 
-static void match(TokenType expected)
-{ if (token == expected) token = getToken();
+static void match(Context * ctx, TokenType expected)
+{ if (ctx->token == expected) ctx->token = getToken(ctx);
   else {
     // 报错点1，这个报错点没有读掉token？
-    syntaxError("unexpected token -> ");
-    printToken(token,tokenString); // 这个函数在util中
-    fprintf(listing,"      ");
+    syntaxError(ctx,"unexpected token -> ");
+    printToken(ctx,ctx->token,ctx->tokenString); // 这个函数在util中
+    fprintf(ctx->listing,"      ");
   }
 }
 
-TreeNode * stmt_sequence(void)
-{ TreeNode * t = statement();
+TreeNode * stmt_sequence(Context * ctx)
+{ TreeNode * t = statement(ctx);
   TreeNode * p = t;
-  while ((token!=ENDFILE) && (token!=END) &&
-         (token!=ELSE) && (token!=UNTIL))
+  while ((ctx->token!=ENDFILE) && (ctx->token!=END) &&
+         (ctx->token!=ELSE) && (ctx->token!=UNTIL))
   { TreeNode * q;
-    match(SEMI);
-    q = statement();
+    match(ctx,SEMI);
+    q = statement(ctx);
     if (q!=NULL) {
       if (t==NULL) t = p = q; // 可能出现这种情况的原因：空语句？
       else /* now p cannot be NULL either */
@@ -63,143 +63,143 @@ TreeNode * stmt_sequence(void)
   return t;
 }
 
-TreeNode * statement(void)
+TreeNode * statement(Context * ctx)
 { TreeNode * t = NULL; // 不建结点
-  switch (token) {
-    case IF : t = if_stmt(); break;
-    case REPEAT : t = repeat_stmt(); break;
-    case ID : t = assign_stmt(); break;
-    case READ : t = read_stmt(); break;
-    case WRITE : t = write_stmt(); break;
+  switch (ctx->token) {
+    case IF : t = if_stmt(ctx); break;
+    case REPEAT : t = repeat_stmt(ctx); break;
+    case ID : t = assign_stmt(ctx); break;
+    case READ : t = read_stmt(ctx); break;
+    case WRITE : t = write_stmt(ctx); break;
     // 报错点2
-    default : syntaxError("unexpected token -> ");
-              printToken(token,tokenString);
-              token = getToken();
+    default : syntaxError(ctx,"unexpected token -> ");
+              printToken(ctx,ctx->token,ctx->tokenString);
+              ctx->token = getToken(ctx);
               break;
   } /* end case */
   return t;
 }
 
-TreeNode * if_stmt(void)
-{ TreeNode * t = newStmtNode(IfK); // 新建结点
-  match(IF);
-  if (t!=NULL) t->child[0] = exp(); // NULL检查内存申请是否成功
-  match(THEN);
-  if (t!=NULL) t->child[1] = stmt_sequence();
-  if (token==ELSE) {
-    match(ELSE);
-    if (t!=NULL) t->child[2] = stmt_sequence();
+TreeNode * if_stmt(Context * ctx)
+{ TreeNode * t = newStmtNode(ctx,IfK); // 新建结点
+  match(ctx,IF);
+  if (t!=NULL) t->child[0] = exp(ctx); // NULL检查内存申请是否成功
+  match(ctx,THEN);
+  if (t!=NULL) t->child[1] = stmt_sequence(ctx);
+  if (ctx->token==ELSE) {
+    match(ctx,ELSE);
+    if (t!=NULL) t->child[2] = stmt_sequence(ctx);
   }
-  match(END);
+  match(ctx,END);
   return t;
 }
 
-TreeNode * repeat_stmt(void)
-{ TreeNode * t = newStmtNode(RepeatK);
-  match(REPEAT);
-  if (t!=NULL) t->child[0] = stmt_sequence();
-  match(UNTIL);
-  if (t!=NULL) t->child[1] = exp();
+TreeNode * repeat_stmt(Context * ctx)
+{ TreeNode * t = newStmtNode(ctx,RepeatK);
+  match(ctx,REPEAT);
+  if (t!=NULL) t->child[0] = stmt_sequence(ctx);
+  match(ctx,UNTIL);
+  if (t!=NULL) t->child[1] = exp(ctx);
   return t;
 }
 
-TreeNode * assign_stmt(void)
-{ TreeNode * t = newStmtNode(AssignK);
-  if ((t!=NULL) && (token==ID))
-    t->attr.name = copyString(tokenString);
-  match(ID);
-  match(ASSIGN);
-  if (t!=NULL) t->child[0] = exp();
+TreeNode * assign_stmt(Context * ctx)
+{ TreeNode * t = newStmtNode(ctx,AssignK);
+  if ((t!=NULL) && (ctx->token==ID))
+    t->attr.name = copyString(ctx,ctx->tokenString);
+  match(ctx,ID);
+  match(ctx,ASSIGN);
+  if (t!=NULL) t->child[0] = exp(ctx);
   return t;
 }
 
-TreeNode * read_stmt(void)
-{ TreeNode * t = newStmtNode(ReadK);
-  match(READ);
-  if ((t!=NULL) && (token==ID))
-    t->attr.name = copyString(tokenString);
-  match(ID);
+TreeNode * read_stmt(Context * ctx)
+{ TreeNode * t = newStmtNode(ctx,ReadK);
+  match(ctx,READ);
+  if ((t!=NULL) && (ctx->token==ID))
+    t->attr.name = copyString(ctx,ctx->tokenString);
+  match(ctx,ID);
   return t;
 }
 
-TreeNode * write_stmt(void)
-{ TreeNode * t = newStmtNode(WriteK);
-  match(WRITE);
-  if (t!=NULL) t->child[0] = exp();
+TreeNode * write_stmt(Context * ctx)
+{ TreeNode * t = newStmtNode(ctx,WriteK);
+  match(ctx,WRITE);
+  if (t!=NULL) t->child[0] = exp(ctx);
   return t;
 }
 
-TreeNode * exp(void)
-{ TreeNode * t = simple_exp();
-  if ((token==LT)||(token==EQ)) { // 这是可选部分
-    TreeNode * p = newExpNode(OpK);
+TreeNode * exp(Context * ctx)
+{ TreeNode * t = simple_exp(ctx);
+  if ((ctx->token==LT)||(ctx->token==EQ)) { // 这是可选部分
+    TreeNode * p = newExpNode(ctx,OpK);
     if (p!=NULL) { // 检查分配是否成功
       p->child[0] = t;
-      p->attr.op = token;
+      p->attr.op = ctx->token;
       t = p;
     }
-    match(token);
+    match(ctx,ctx->token);
     if (t!=NULL) // 这个检查是什么意思？
-      t->child[1] = simple_exp();
+      t->child[1] = simple_exp(ctx);
   }
   return t;
 }
 
-TreeNode * simple_exp(void)
-{ TreeNode * t = term();
-  while ((token==PLUS)||(token==MINUS)) // 这是重复部分
-  { TreeNode * p = newExpNode(OpK);
+TreeNode * simple_exp(Context * ctx)
+{ TreeNode * t = term(ctx);
+  while ((ctx->token==PLUS)||(ctx->token==MINUS)) // 这是重复部分
+  { TreeNode * p = newExpNode(ctx,OpK);
     if (p!=NULL) {
       p->child[0] = t;
-      p->attr.op = token;
+      p->attr.op = ctx->token;
       t = p;
-      match(token);
-      t->child[1] = term();
+      match(ctx,ctx->token);
+      t->child[1] = term(ctx);
     }
   }
   return t;
 }
 
-TreeNode * term(void)
-{ TreeNode * t = factor();
-  while ((token==TIMES)||(token==OVER))
-  { TreeNode * p = newExpNode(OpK);
+TreeNode * term(Context * ctx)
+{ TreeNode * t = factor(ctx);
+  while ((ctx->token==TIMES)||(ctx->token==OVER))
+  { TreeNode * p = newExpNode(ctx,OpK);
     if (p!=NULL) {
       p->child[0] = t;
-      p->attr.op = token;
+      p->attr.op = ctx->token;
       t = p;
-      match(token);
-      p->child[1] = factor();
+      match(ctx,ctx->token);
+      p->child[1] = factor(ctx);
     }
   }
   return t;
 }
 
-TreeNode * factor(void)
+TreeNode * factor(Context * ctx)
 { TreeNode * t = NULL;
-  switch (token) {
+  switch (ctx->token) {
     case NUM :
-      t = newExpNode(ConstK);
-      if ((t!=NULL) && (token==NUM))
-        t->attr.val = atoi(tokenString);
-      match(NUM);
+      t = newExpNode(ctx,ConstK);
+      if ((t!=NULL) && (ctx->token==NUM))
+        t->attr.val = atoi(ctx->tokenString);
+      match(ctx,NUM);
       break;
     case ID :
-      t = newExpNode(IdK);
-      if ((t!=NULL) && (token==ID))
-        t->attr.name = copyString(tokenString);
-      match(ID);
+      t = newExpNode(ctx,IdK);
+      if ((t!=NULL) && (ctx->token==ID))
+        t->attr.name = copyString(ctx,ctx->tokenString);
+      match(ctx,ID);
       break;
     case LPAREN : // 左括号
-      match(LPAREN);
-      t = exp();
-      match(RPAREN);
+      match(ctx,LPAREN);
+      t = exp(ctx);
+      match(ctx,RPAREN);
       break;
     default:
       // 报错点3
-      syntaxError("unexpected token -> ");
-      printToken(token,tokenString);
-      token = getToken();
+      syntaxError(ctx,"unexpected token -> ");
+      printToken(ctx,ctx->token,ctx->tokenString);
+      ctx->token = getToken(ctx);
       break;
     }
   return t;
@@ -211,11 +211,11 @@ TreeNode * factor(void)
 /* Function parse returns the newly 
  * constructed syntax tree
  */
-TreeNode * parse(void)
+TreeNode * parse(Context * ctx)
 { TreeNode * t;
-  token = getToken(); // 读入第一个token
-  t = stmt_sequence(); // 剩下交给这个函数
-  if (token!=ENDFILE) // 最后检查，不能留有token
-    syntaxError("Code ends before file\n"); // 报错点4
+  ctx->token = getToken(ctx); // 读入第一个token
+  t = stmt_sequence(ctx); // 剩下交给这个函数
+  if (ctx->token!=ENDFILE) // 最后检查，不能留有token
+    syntaxError(ctx,"Code ends before file\n"); // 报错点4
   return t;
 }
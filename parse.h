@@ -12,6 +12,6 @@
  * constructed syntax tree
  */
 // 返回值是指针，即是一颗树
-TreeNode * parse(void);
+TreeNode * parse(Context *);
 
 #endif
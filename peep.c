@@ -0,0 +1,307 @@
+/****************************************************/
+/* File: peep.c                                     */
+/* Peephole optimizer for the TM code               */
+/* generated by the TINY compiler                   */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "code.h"
+#include "peep.h"
+
+// 在缓存的整个程序上做窥孔优化：先把相对pc的跳转换成绝对地址，
+// 删除的指令只做标记，最后压缩程序并重新计算所有相对偏移
+
+/* the program being optimized */
+typedef struct
+   { Instruction * code;
+     int n; /* number of locations */
+     int * target; /* absolute target of a jump, -1 if not a jump */
+     char * dead; /* TRUE once an instruction is removed */
+     char * label; /* TRUE if some jump may reach the location */
+   } Peep;
+
+/* a peephole rule: apply looks at the window
+ * starting at live location loc and returns the
+ * number of instructions it removed, or -1 if
+ * the rule does not match
+ */
+typedef struct
+   { char * name;
+     int (* apply) (Peep * p, int loc);
+   } Rule;
+
+/* isJump is TRUE for the pc-relative jumps
+ * generated by emitRM_Abs and genExp
+ */
+#define isJump(i) ((i)->s == pc && (((i)->op >= opJLT && (i)->op <= opJNE) || \
+                   ((i)->op == opLDA && (i)->r == pc)))
+
+/* isGoto is TRUE for an unconditional jump */
+#define isGoto(i) ((i)->op == opLDA && (i)->r == pc && (i)->s == pc)
+
+/* Function nextLive returns the first location
+ * after loc that has not been removed
+ */
+static int nextLive( Peep * p, int loc )
+{ do loc++; while ((loc < p->n) && p->dead[loc]);
+  return loc;
+}
+
+/* Function prevLive returns the last location
+ * before loc that has not been removed, or -1
+ */
+static int prevLive( Peep * p, int loc )
+{ do loc--; while ((loc >= 0) && p->dead[loc]);
+  return loc;
+}
+
+/* Function resolve returns the live location
+ * where execution continues when it reaches loc
+ */
+static int resolve( Peep * p, int loc )
+{ return ((loc < p->n) && p->dead[loc]) ? nextLive(p,loc) : loc; }
+
+/* Procedure kill removes the instruction at loc;
+ * jumps to it now reach the next live location
+ */
+static void kill( Peep * p, int loc )
+{ int next = nextLive(p,loc);
+  p->dead[loc] = TRUE;
+  if (p->label[loc] && (next < p->n)) p->label[next] = TRUE;
+}
+
+/* Function reads returns TRUE if instruction i
+ * reads register r
+ */
+static int reads( Instruction * i, int r )
+{ switch (i->op)
+  { case opHALT: case opIN: return FALSE;
+    case opOUT: return i->r == r;
+    case opADD: case opSUB: case opMUL: case opDIV:
+      return (i->s == r) || (i->t == r);
+    case opLD: case opLDA: return i->s == r;
+    case opLDC: return FALSE;
+    case opST: return (i->r == r) || (i->s == r);
+    default: return TRUE; /* jumps test r; opNONE is unknown */
+  }
+}
+
+/* Function writes returns TRUE if instruction i
+ * sets register r
+ */
+static int writes( Instruction * i, int r )
+{ switch (i->op)
+  { case opIN: case opADD: case opSUB: case opMUL: case opDIV:
+    case opLD: case opLDA: case opLDC:
+      return i->r == r;
+    default: return FALSE;
+  }
+}
+
+/* PEEPWINDOW bounds how far a rule looks
+ * ahead: jumps followed in a chain and
+ * instructions searched for the next use
+ * of a register
+ */
+#define PEEPWINDOW 8
+
+/* rule "null jump": a jump to the next
+ * instruction does nothing
+ */
+static int nullJump( Peep * p, int loc )
+{ if (isJump(&p->code[loc]) && (resolve(p,p->target[loc]) == nextLive(p,loc)))
+  { kill(p,loc);
+    return 1;
+  }
+  return -1;
+}
+
+/* rule "jump to jump": a jump to an
+ * unconditional jump goes to its target
+ */
+static int jumpToJump( Peep * p, int loc )
+{ int t, w = 0;
+  if (! isJump(&p->code[loc])) return -1;
+  t = resolve(p,p->target[loc]);
+  while ((t < p->n) && isGoto(&p->code[t]) && (w++ < PEEPWINDOW))
+    t = resolve(p,p->target[t]);
+  if ((t < p->n) && isGoto(&p->code[t])) return -1; /* a loop of jumps */
+  if (t == resolve(p,p->target[loc])) return -1;
+  p->target[loc] = t;
+  p->label[t] = TRUE;
+  return 0;
+}
+
+/* rule "unreachable": nothing jumps to an
+ * instruction after an unconditional jump
+ * or a HALT
+ */
+static int unreachable( Peep * p, int loc )
+{ int prev = prevLive(p,loc);
+  Instruction * i;
+  if ((prev < 0) || p->label[loc] || (p->code[loc].op == opNONE)) return -1;
+  i = &p->code[prev];
+  if (! isGoto(i) && (i->op != opHALT)) return -1;
+  kill(p,loc);
+  return 1;
+}
+
+/* rule "store-load": a load from the location
+ * just stored needs no memory access
+ */
+static int storeLoad( Peep * p, int loc )
+{ Instruction * st = &p->code[loc], * ld;
+  int next = nextLive(p,loc);
+  if ((st->op != opST) || (next >= p->n) || p->label[next]) return -1;
+  ld = &p->code[next];
+  if ((ld->op != opLD) || (ld->d != st->d) || (ld->s != st->s)) return -1;
+  if (ld->r == st->r) /* the register already holds the value */
+  { kill(p,next);
+    return 1;
+  }
+  if ((ld->r == pc) || (st->r == pc)) return -1;
+  ld->op = opLDA; /* copy the register instead */
+  ld->d = 0;
+  ld->s = st->r;
+  return 0;
+}
+
+/* rule "dead load": a constant or address
+ * loaded into a register that is set again
+ * before it is read is never used
+ */
+static int deadLoad( Peep * p, int loc )
+{ Instruction * i = &p->code[loc];
+  int k, w;
+  if (((i->op != opLDC) && (i->op != opLDA)) || (i->r == pc)) return -1;
+  for (k=nextLive(p,loc), w=0; (k < p->n) && (w < PEEPWINDOW); k=nextLive(p,k), w++)
+  { Instruction * j = &p->code[k];
+    if (reads(j,i->r) || isJump(j) || (j->op == opHALT)) return -1;
+    if (writes(j,i->r))
+    { kill(p,loc);
+      return 1;
+    }
+  }
+  return -1;
+}
+
+/* rule "self move": LDA r,0(r) leaves r as it is */
+static int selfMove( Peep * p, int loc )
+{ Instruction * i = &p->code[loc];
+  if ((i->op == opLDA) && (i->d == 0) && (i->r == i->s) && (i->r != pc))
+  { kill(p,loc);
+    return 1;
+  }
+  return -1;
+}
+
+/* the rule table, applied in this order at
+ * every location until nothing changes
+ */
+static Rule ruleTab[]
+   = { { "null jump", nullJump },
+       { "jump to jump", jumpToJump },
+       { "unreachable", unreachable },
+       { "store-load", storeLoad },
+       { "dead load", deadLoad },
+       { "self move", selfMove } };
+
+#define NRULES ((int) (sizeof(ruleTab)/sizeof(ruleTab[0])))
+
+/* MAXROUNDS bounds the passes over the program */
+#define MAXROUNDS 16
+
+/* Function usesPc returns TRUE if instruction i
+ * reads or sets pc other than as a pc-relative
+ * jump; such programs are left alone
+ */
+static int usesPc( Instruction * i )
+{ if (i->op == opNONE) return FALSE;
+  if (isRO(i->op))
+    return (i->r == pc) || (i->s == pc) || (i->t == pc);
+  return ((i->r == pc) || (i->s == pc)) && ! isJump(i);
+}
+
+/* Procedure peephole rewrites the buffered TM
+ * program of ctx before it is written, removing
+ * redundant instructions and fixing up all
+ * pc-relative displacements
+ */
+void peephole( Context * ctx )
+{ Peep p;
+  int applied[NRULES], removed[NRULES];
+  int * newLoc;
+  int loc, k, round, changed, total = 0;
+  p.code = ctx->codeBuf->iMem;
+  p.n = ctx->highEmitLoc;
+  if (p.n <= 0) return; /* empty program */
+  for (loc=0;loc<p.n;loc++)
+    if (usesPc(&p.code[loc]) ||
+        (isJump(&p.code[loc]) &&
+         ((loc+1+p.code[loc].d < 0) || (loc+1+p.code[loc].d > p.n))))
+      return; /* cannot relocate, so leave it alone */
+  p.target = (int *) malloc(p.n*sizeof(int));
+  p.dead = (char *) calloc(p.n,1);
+  p.label = (char *) calloc(p.n+1,1);
+  newLoc = (int *) malloc((p.n+1)*sizeof(int));
+  for (loc=0;loc<p.n;loc++) // 相对地址换成绝对地址
+    p.target[loc] = isJump(&p.code[loc]) ? loc+1+p.code[loc].d : -1;
+  for (k=0;k<NRULES;k++) applied[k] = removed[k] = 0;
+  for (round=0, changed=TRUE; changed && (round < MAXROUNDS); round++)
+  { changed = FALSE;
+    memset(p.label,0,p.n+1);
+    p.label[0] = TRUE; /* execution starts here */
+    for (loc=0;loc<p.n;loc++)
+      if (! p.dead[loc] && (p.target[loc] >= 0))
+        p.label[resolve(&p,p.target[loc])] = TRUE;
+    for (loc=0;loc<p.n;loc++)
+      for (k=0;(k<NRULES) && ! p.dead[loc];k++)
+      { int r = ruleTab[k].apply(&p,loc);
+        if (r >= 0)
+        { applied[k]++;
+          removed[k] += r;
+          changed = TRUE;
+        }
+      }
+  }
+  /* compact the program and fix displacements */
+  // 被删除的位置映射到其后第一条保留的指令
+  newLoc[p.n] = 0;
+  for (loc=0;loc<p.n;loc++)
+    if (! p.dead[loc]) newLoc[p.n]++;
+  for (loc=p.n-1, k=newLoc[p.n]; loc>=0; loc--)
+    newLoc[loc] = p.dead[loc] ? newLoc[loc+1] : --k;
+  for (loc=0;loc<p.n;loc++)
+    if (! p.dead[loc])
+    { Instruction * i = &p.code[loc];
+      if (p.target[loc] >= 0)
+        i->d = newLoc[p.target[loc]] - (newLoc[loc]+1);
+      p.code[newLoc[loc]] = *i;
+    }
+  for (loc=newLoc[p.n];loc<p.n;loc++) p.code[loc].op = opNONE;
+  for (k=0;k<ctx->codeBuf->ncomments;k++)
+  { CodeComment * c = &ctx->codeBuf->comments[k];
+    if (c->loc <= p.n) c->loc = newLoc[c->loc];
+  }
+  for (k=0;k<ctx->codeBuf->nsites;k++)
+  { CodeSite * c = &ctx->codeBuf->sites[k];
+    if ((c->loc >= 0) && (c->loc < p.n))
+      c->loc = p.dead[c->loc] ? -1 : newLoc[c->loc]; /* jump removed */
+  }
+  ctx->highEmitLoc = ctx->emitLoc = newLoc[p.n];
+  if (TraceCode)
+  { fprintf(ctx->listing,"\nPeephole optimization:\n\n");
+    fprintf(ctx->listing,"Rule           Applied   Removed\n");
+    fprintf(ctx->listing,"-------------  -------   -------\n");
+    for (k=0;k<NRULES;k++)
+    { fprintf(ctx->listing,"%-14s %7d   %7d\n",ruleTab[k].name,applied[k],removed[k]);
+      total += removed[k];
+    }
+    fprintf(ctx->listing,"%-14s %7s   %7d\n","total","",total);
+  }
+  free(p.target);
+  free(p.dead);
+  free(p.label);
+  free(newLoc);
+}
@@ -0,0 +1,20 @@
+/****************************************************/
+/* File: peep.h                                     */
+/* Peephole optimizer interface for the TM code     */
+/* generated by the TINY compiler                   */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _PEEP_H_
+#define _PEEP_H_
+
+/* Procedure peephole rewrites the buffered TM
+ * program of ctx before it is written, removing
+ * redundant instructions and fixing up all
+ * pc-relative displacements. If TraceCode is
+ * TRUE the number of instructions each rule
+ * removed is printed to the listing
+ */
+void peephole( Context * ctx );
+
+#endif
@@ -0,0 +1,188 @@
+/****************************************************/
+/* File: peval.c                                    */
+/* Compile time evaluation of the part of a TINY   */
+/* program that does not depend on its input        */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "util.h"
+#include "fold.h"
+#include "peval.h"
+#include <limits.h>
+
+// 从程序开头起逐条执行顶层语句，变量的初值和TM一样都是0。
+// 一条顶层语句执行中遇到read、除以0或步数用完，就撤销它的全部效果并停下，
+// 这条语句和之后的部分留到运行时；已执行的部分换成输出常数的write
+// 和给变量赋终值的赋值，之后删除无用赋值时没人读的赋值会被删掉
+
+/* MAXOUTPUTS = the most values written by the
+ * statements evaluated, since each becomes a
+ * write statement in the program
+ */
+#define MAXOUTPUTS 128
+
+/* the state of the evaluation */
+typedef struct
+   { Context * ctx;
+     int * value; /* value of each variable */
+     char ** name; /* name of each variable assigned, NULL if none */
+     int * out; /* values written */
+     int * outLine; /* line of the write of each */
+     int nout;
+     long steps; /* steps left */
+   } Eval;
+
+/* Function evalExp computes expression t into *v;
+ * it returns FALSE if the machine would stop or
+ * the steps run out
+ */
+static int evalExp( Eval * e, TreeNode * t, int * v )
+{ int a, b;
+  if (--e->steps < 0) return FALSE;
+  switch (t->kind.exp)
+  { case ConstK:
+      *v = t->attr.val;
+      return TRUE;
+    case IdK:
+      *v = e->value[t->symbol];
+      return TRUE;
+    case OpK:
+      if (! evalExp(e,t->child[0],&a) || ! evalExp(e,t->child[1],&b))
+        return FALSE;
+      if ((t->attr.op == OVER) && ((b == 0) || ((b == -1) && (a == INT_MIN))))
+        return FALSE; /* leave it to trap at run time */
+      *v = evalOp(t->attr.op,a,b);
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static int evalStmts( Eval * e, TreeNode * t );
+
+/* Function evalStmt runs statement t; it returns
+ * FALSE if it reads input, the machine would
+ * stop, the steps run out or too many values are
+ * written
+ */
+static int evalStmt( Eval * e, TreeNode * t )
+{ int v;
+  if (--e->steps < 0) return FALSE;
+  switch (t->kind.stmt)
+  { case IfK:
+      return evalExp(e,t->child[0],&v) && evalStmts(e,t->child[v ? 1 : 2]);
+    case RepeatK:
+      do
+        if (! evalStmts(e,t->child[0]) || ! evalExp(e,t->child[1],&v))
+          return FALSE;
+      while (! v);
+      return TRUE;
+    case AssignK:
+      if (! evalExp(e,t->child[0],&v)) return FALSE;
+      e->value[t->symbol] = v;
+      e->name[t->symbol] = t->attr.name;
+      return TRUE;
+    case WriteK:
+      if ((e->nout == MAXOUTPUTS) || ! evalExp(e,t->child[0],&v))
+        return FALSE;
+      e->outLine[e->nout] = t->lineno;
+      e->out[e->nout++] = v;
+      return TRUE;
+    default: /* read */
+      return FALSE;
+  }
+}
+
+/* Function evalStmts runs the statement sequence
+ * t, returning FALSE as evalStmt does
+ */
+static int evalStmts( Eval * e, TreeNode * t )
+{ for (;t != NULL;t=t->sibling)
+    if (! evalStmt(e,t)) return FALSE;
+  return TRUE;
+}
+
+/* Function constNode returns a new constant
+ * expression with value v
+ */
+static TreeNode * constNode( Context * ctx, int v, int lineno )
+{ TreeNode * t = newExpNode(ctx,ConstK);
+  t->attr.val = v;
+  t->type = Integer;
+  t->lineno = lineno;
+  return t;
+}
+
+/* Function residual returns the statements that
+ * replace the statements evaluated: the writes
+ * of the values written, then the assignments of
+ * the final values to the variables assigned
+ */
+static TreeNode * residual( Eval * e )
+{ TreeNode * head = NULL;
+  TreeNode ** tail = &head;
+  TreeNode * s;
+  int i;
+  for (i=0;i<e->nout;i++)
+  { s = newStmtNode(e->ctx,WriteK);
+    s->lineno = e->outLine[i];
+    s->child[0] = constNode(e->ctx,e->out[i],s->lineno);
+    *tail = s;
+    tail = &s->sibling;
+  }
+  for (i=0;i<e->ctx->location;i++)
+    if (e->name[i] != NULL)
+    { s = newStmtNode(e->ctx,AssignK);
+      s->attr.name = copyString(e->ctx,e->name[i]);
+      s->symbol = i;
+      s->child[0] = constNode(e->ctx,e->value[i],s->lineno);
+      *tail = s;
+      tail = &s->sibling;
+    }
+  return head;
+}
+
+TreeNode * evalPrefix( Context * ctx, TreeNode * syntaxTree )
+{ Eval e;
+  TreeNode * t, * head;
+  TreeNode ** end = &syntaxTree;
+  int * savedValue;
+  char ** savedName;
+  int n = ctx->location;
+  if ((EvalBudget <= 0) || (syntaxTree == NULL)) return syntaxTree;
+  e.ctx = ctx;
+  e.value = (int *) calloc(2*n+2*MAXOUTPUTS,sizeof(int));
+  savedValue = e.value + n;
+  e.out = savedValue + n;
+  e.outLine = e.out + MAXOUTPUTS;
+  e.name = (char **) calloc(2*n+1,sizeof(char *));
+  savedName = e.name + n;
+  ctx->allocBytes += (2*n+2*MAXOUTPUTS)*sizeof(int) + (2*n+1)*sizeof(char *);
+  e.nout = 0;
+  e.steps = EvalBudget;
+  for (t=syntaxTree;t != NULL;t=t->sibling)
+  { int nout = e.nout;
+    memcpy(savedValue,e.value,n*sizeof(int));
+    memcpy(savedName,e.name,n*sizeof(char *));
+    if (! evalStmt(&e,t)) /* undo it and leave the rest to run time */
+    { memcpy(e.value,savedValue,n*sizeof(int));
+      memcpy(e.name,savedName,n*sizeof(char *));
+      e.nout = nout;
+      break;
+    }
+    end = &t->sibling;
+  }
+  if (end != &syntaxTree) /* some statements ran */
+  { t = *end;
+    *end = NULL;
+    head = residual(&e);
+    freeTree(syntaxTree);
+    for (end=&head;*end != NULL;end=&(*end)->sibling);
+    *end = t;
+    syntaxTree = head;
+  }
+  free(e.value);
+  free(e.name);
+  return syntaxTree;
+}
@@ -0,0 +1,24 @@
+/****************************************************/
+/* File: peval.h                                    */
+/* Compile time evaluation of the part of a TINY   */
+/* program that does not depend on its input        */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _PEVAL_H_
+#define _PEVAL_H_
+
+/* Function evalPrefix runs at compile time the
+ * top level statements of the type checked syntax
+ * tree up to the first one that reads input, would
+ * stop the machine with a division by 0 or does
+ * not finish within EvalBudget steps. They are
+ * replaced by writes of the values they write
+ * and assignments of the values they leave in
+ * the variables; the statement that stopped the
+ * evaluation and the rest run as before. It
+ * returns the new tree
+ */
+TreeNode * evalPrefix(Context * ctx, TreeNode * syntaxTree);
+
+#endif
@@ -0,0 +1,98 @@
+/****************************************************/
+/* File: profile.c                                  */
+/* Execution profiles from the TM simulator for    */
+/* the TINY compiler                                */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "profile.h"
+
+// 剖析的流程：tiny编译时把每个if/repeat的条件跳转所在的地址写在代码文件末尾的注释里，
+// tm -p运行程序时统计每条指令的执行次数和跳转次数，再按这些地址归到各个站点上；
+// tiny -fprofile-use读回来，站点编号就对应回语法树上的结点
+
+/* the counts of a profile, one entry per site */
+typedef struct profileRec
+   { int nsites;
+     long * count; /* times the test was evaluated */
+     long * ntrue; /* times the test was true */
+     long * copies; /* jumps counted for the site, 0 if none */
+   } Profile;
+
+/* Procedure numberTree numbers the sites of t
+ * and its siblings in preorder
+ */
+static void numberTree( Context * ctx, TreeNode * t )
+{ int i;
+  for (;t != NULL;t=t->sibling)
+    if (t->nodekind == StmtK)
+    { if ((t->kind.stmt == IfK) || (t->kind.stmt == RepeatK))
+        t->site = ctx->nsites++;
+      for (i=0;i<MAXCHILDREN;i++) numberTree(ctx,t->child[i]);
+    }
+}
+
+void numberSites( Context * ctx, TreeNode * syntaxTree )
+{ ctx->nsites = 0;
+  numberTree(ctx,syntaxTree);
+}
+
+/* MAXLINE = the longest line of a profile */
+#define MAXLINE 128
+
+int readProfile( Context * ctx, char * name )
+{ FILE * f = fopen(name,"r");
+  char line[MAXLINE];
+  Profile * p;
+  int n, nsites = -1;
+  long count, taken;
+  char sense;
+  if (f == NULL) return FALSE;
+  // 计数和结构体一次分配，freeContext只需一个free
+  p = (Profile *) calloc(1,sizeof(Profile) + 3*ctx->nsites*sizeof(long));
+  p->nsites = ctx->nsites;
+  p->count = (long *) (p + 1);
+  p->ntrue = p->count + ctx->nsites;
+  p->copies = p->ntrue + ctx->nsites;
+  while (fgets(line,MAXLINE,f) != NULL)
+  { if (sscanf(line,"sites %d",&n) == 1)
+      nsites = n;
+    else if ((sscanf(line,"site %d %c %ld %ld",&n,&sense,&count,&taken) == 4) &&
+             (n >= 0) && (n < p->nsites))
+    { /* a site may have several copies of its test */
+      p->count[n] += count;
+      p->ntrue[n] += (sense == 't') ? taken : count - taken;
+      p->copies[n]++;
+    }
+  }
+  fclose(f);
+  if (nsites != ctx->nsites)
+  { fprintf(ctx->listing,"Warning: profile %s does not match the program,"
+                         " ignored\n",name);
+    free(p);
+    return TRUE;
+  }
+  free(ctx->profile);
+  ctx->profile = p;
+  return TRUE;
+}
+
+int siteCounts( Context * ctx, int site, long * count, long * ntrue )
+{ Profile * p = ctx->profile;
+  if ((p == NULL) || (site < 0) || (site >= p->nsites) ||
+      (p->copies[site] == 0)) /* its jump was optimized away */
+    return FALSE;
+  *count = p->count[site];
+  *ntrue = p->ntrue[site];
+  return TRUE;
+}
+
+// TM上条件跳转无论是否跳转都只算一步，能省的是跳过另一个分支的无条件跳转：
+// then部分在后面时，从then部分直接落到if之后，只有else部分要跳
+int hotThen( Context * ctx, TreeNode * t )
+{ long count, ntrue;
+  if ((t->kind.stmt != IfK) || (t->child[2] == NULL)) return FALSE;
+  if (! siteCounts(ctx,t->site,&count,&ntrue)) return FALSE;
+  return ntrue > count - ntrue;
+}
@@ -0,0 +1,46 @@
+/****************************************************/
+/* File: profile.h                                  */
+/* Execution profiles from the TM simulator for    */
+/* the TINY compiler                                */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+/* A profile site is an if or repeat statement.
+ * Sites are numbered in preorder after parsing;
+ * the code generators mark the conditional jump
+ * of each site with emitSite (code.h), tm -p
+ * counts how often each one ran and was taken,
+ * and -fprofile-use reads the counts back
+ */
+
+/* Procedure numberSites numbers the if and repeat
+ * statements of the syntax tree, setting the site
+ * of each node and ctx->nsites
+ */
+void numberSites(Context * ctx, TreeNode * syntaxTree);
+
+/* Function readProfile reads the profile written
+ * by tm -p for the program of ctx from file name.
+ * It returns FALSE if the file cannot be opened;
+ * a profile of some other program is reported to
+ * the listing and ignored
+ */
+int readProfile(Context * ctx, char * name);
+
+/* Function siteCounts returns TRUE if the profile
+ * of ctx has counts for the test of site: *count
+ * is the number of times the test was evaluated,
+ * *ntrue the number of times it was true
+ */
+int siteCounts(Context * ctx, int site, long * count, long * ntrue);
+
+/* Function hotThen returns TRUE if t is an if
+ * statement with an else part whose then part
+ * ran more often according to the profile
+ */
+int hotThen(Context * ctx, TreeNode * t);
+
+#endif
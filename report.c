@@ -0,0 +1,126 @@
+/****************************************************/
+/* File: report.c                                   */
+/* Per-phase time report for the TINY compiler      */
+/* (wall and CPU time, allocations, sizes, peak RSS)*/
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "symtab.h"
+#include "report.h"
+#include <time.h>
+#include <sys/resource.h>
+
+/* phase names as printed in the report */
+static char * phaseName[MAXPHASE]
+   = { "parse","analyze","fold","codegen" };
+
+/* the measurements of one phase */
+typedef struct
+   { double wall; /* seconds */
+     double cpu; /* seconds of this thread's CPU time */
+     long bytes; /* bytes allocated */
+     /* values at phaseStart */
+     double wall0, cpu0;
+     long bytes0;
+   } PhaseRec;
+
+struct timeReportRec
+   { PhaseRec phase[MAXPHASE];
+     PhaseRec total;
+   };
+
+// CPU时间按线程统计，这样-j并行编译时各文件的报告互不干扰
+static double now( clockid_t clock )
+{ struct timespec ts;
+  clock_gettime(clock,&ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Function allocated returns the bytes allocated
+ * so far by the compilation in ctx
+ */
+static long allocated( Context * ctx )
+{ return ctx->allocBytes + st_bytes(ctx->symtab); }
+
+static void startRec( Context * ctx, PhaseRec * p )
+{ p->wall0 = now(CLOCK_MONOTONIC);
+  p->cpu0 = now(CLOCK_THREAD_CPUTIME_ID);
+  p->bytes0 = allocated(ctx);
+}
+
+static void stopRec( Context * ctx, PhaseRec * p )
+{ p->wall += now(CLOCK_MONOTONIC) - p->wall0;
+  p->cpu += now(CLOCK_THREAD_CPUTIME_ID) - p->cpu0;
+  p->bytes += allocated(ctx) - p->bytes0;
+}
+
+/* Procedure startReport turns on the time report
+ * for ctx and starts its total clock
+ */
+void startReport( Context * ctx )
+{ ctx->report = (struct timeReportRec *)
+                calloc(1,sizeof(struct timeReportRec));
+  if (ctx->report != NULL) startRec(ctx,&ctx->report->total);
+}
+
+/* Procedures phaseStart and phaseStop bracket one
+ * run of a phase
+ */
+void phaseStart( Context * ctx, PhaseKind phase )
+{ if (ctx->report != NULL) startRec(ctx,&ctx->report->phase[phase]); }
+
+void phaseStop( Context * ctx, PhaseKind phase )
+{ if (ctx->report != NULL) stopRec(ctx,&ctx->report->phase[phase]); }
+
+/* Function peakRSS returns the peak resident set
+ * size of the process in kilobytes
+ */
+static long peakRSS( void )
+{ struct rusage ru;
+  if (getrusage(RUSAGE_SELF,&ru) != 0) return 0;
+  return ru.ru_maxrss;
+}
+
+/* Procedure printReport stops the total clock and
+ * prints the report for program pgm to out
+ */
+void printReport( Context * ctx, char * pgm, FILE * out, int json )
+{ struct timeReportRec * r = ctx->report;
+  int i;
+  if (r == NULL) return;
+  stopRec(ctx,&r->total);
+  if (json)
+  { fprintf(out,"{\"file\":\"");
+    for (i=0;pgm[i]!='\0';i++)
+    { if ((pgm[i]=='"') || (pgm[i]=='\\')) fputc('\\',out);
+      fputc(pgm[i],out);
+    }
+    fprintf(out,"\",\"phases\":[");
+    for (i=0;i<MAXPHASE;i++)
+      fprintf(out,"%s{\"name\":\"%s\",\"wall_ms\":%.3f,"
+                  "\"cpu_ms\":%.3f,\"bytes\":%ld}",
+              i ? "," : "",phaseName[i],r->phase[i].wall*1e3,
+              r->phase[i].cpu*1e3,r->phase[i].bytes);
+    fprintf(out,"],\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,"
+                "\"bytes\":%ld},",
+            r->total.wall*1e3,r->total.cpu*1e3,r->total.bytes);
+    fprintf(out,"\"tokens\":%d,\"nodes\":%d,\"symbols\":%d,"
+                "\"instructions\":%d,\"peak_rss_kb\":%ld}\n",
+            ctx->ntokens,ctx->nnodes,ctx->location,
+            ctx->highEmitLoc,peakRSS());
+  }
+  else
+  { fprintf(out,"\nTime report for %s:\n",pgm);
+    fprintf(out," %-12s %12s %12s %12s\n",
+            "phase","wall (ms)","cpu (ms)","bytes");
+    for (i=0;i<MAXPHASE;i++)
+      fprintf(out," %-12s %12.3f %12.3f %12ld\n",phaseName[i],
+              r->phase[i].wall*1e3,r->phase[i].cpu*1e3,r->phase[i].bytes);
+    fprintf(out," %-12s %12.3f %12.3f %12ld\n","TOTAL",
+            r->total.wall*1e3,r->total.cpu*1e3,r->total.bytes);
+    fprintf(out," tokens: %d  nodes: %d  symbols: %d  instructions: %d\n",
+            ctx->ntokens,ctx->nnodes,ctx->location,ctx->highEmitLoc);
+    fprintf(out," peak RSS: %ld kB\n",peakRSS());
+  }
+} /* printReport */
@@ -0,0 +1,34 @@
+/****************************************************/
+/* File: report.h                                   */
+/* Per-phase time report for the TINY compiler      */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _REPORT_H_
+#define _REPORT_H_
+
+/* the phases measured by the time report */
+typedef enum
+   { ParsePhase,AnalyzePhase,FoldPhase,CodePhase,MAXPHASE }
+   PhaseKind;
+
+/* Procedure startReport turns on the time report
+ * for ctx and starts its total clock
+ */
+void startReport( Context * ctx );
+
+/* Procedures phaseStart and phaseStop bracket one
+ * run of a phase; time and allocations between
+ * them are added to the phase. Both do nothing
+ * unless startReport was called for ctx
+ */
+void phaseStart( Context * ctx, PhaseKind phase );
+void phaseStop( Context * ctx, PhaseKind phase );
+
+/* Procedure printReport stops the total clock and
+ * prints the report for program pgm to out, as
+ * text or (if json is TRUE) as one JSON object
+ */
+void printReport( Context * ctx, char * pgm, FILE * out, int json );
+
+#endif
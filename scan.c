@@ -8,6 +8,12 @@
 #include "globals.h"
 #include "util.h"
 #include "scan.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* states in scanner DFA */
 // 有限状态机的状态通过枚举实现
@@ -15,46 +21,45 @@ typedef enum
    { START,INASSIGN,INCOMMENT,INNUM,INID,DONE }
    StateType;
 
-/* lexeme of identifier or reserved word */
-char tokenString[MAXTOKENLEN+1]; // 加一以容纳结束符
-
-/* BUFLEN = length of the input buffer for
-   source code lines */
-// 缓冲区大小，256个字符
-#define BUFLEN 256
-
-// 静态变量保证安全
-static char lineBuf[BUFLEN]; /* holds the current line */
-static int linepos = 0; /* current position in LineBuf */
-static int bufsize = 0; /* current size of buffer string */
-static int EOF_flag = FALSE; /* corrects ungetNextChar behavior on EOF */
+// 扫描器的状态（tokenString/lineBuf/linepos/bufsize/EOF_flag）
+// 都保存在Context中，缓冲区大小BUFLEN也定义在globals.h
 
 /* getNextChar fetches the next non-blank character
    from lineBuf, reading in a new line if lineBuf is
    exhausted */
-static int getNextChar(void)
-{ if (!(linepos < bufsize))
-  { lineno++; // 行号加一
-    if (fgets(lineBuf,BUFLEN-1,source)) // 源代码一行最多255个字符
-    { if (EchoSource) fprintf(listing,"%4d: %s",lineno,lineBuf);
-      bufsize = strlen(lineBuf);
-      linepos = 0; // 指针置成零
-      return lineBuf[linepos++];
+static int getNextChar(Context * ctx)
+{ if (!(ctx->linepos < ctx->bufsize))
+  { ctx->lineno++; // 行号加一
+    if (fgets(ctx->lineBuf,BUFLEN-1,ctx->source)) // 源代码一行最多255个字符
+    { if (EchoSource) fprintf(ctx->listing,"%4d: %s",ctx->lineno,ctx->lineBuf);
+      ctx->bufsize = strlen(ctx->lineBuf);
+      ctx->linepos = 0; // 指针置成零
+      return ctx->lineBuf[ctx->linepos++];
     }
     else //遇到文件结束
-    { EOF_flag = TRUE;
+    { ctx->EOF_flag = TRUE;
       return EOF;
     }
   }
-  else return lineBuf[linepos++];
+  else return ctx->lineBuf[ctx->linepos++];
 }
 
 /* ungetNextChar backtracks one character
    in lineBuf */
 // 注意行首的字符是不能unget的，靠使用者保证。
 // 这里只检查文件末尾不能unget。
-static void ungetNextChar(void)
-{ if (!EOF_flag) linepos-- ;}
+static void ungetNextChar(Context * ctx)
+{ if (!ctx->EOF_flag) ctx->linepos-- ;}
+
+/* Procedure resetScanner discards any buffered
+ * input so that a new source file can be scanned
+ */
+void resetScanner(Context * ctx)
+{ ctx->linepos = 0;
+  ctx->bufsize = 0;
+  ctx->EOF_flag = FALSE;
+  ctx->inComment = FALSE;
+}
 
 /* lookup table of reserved words */
 // TokenType的宏定义在globals.h中，真正的对照表在这里
@@ -79,20 +84,22 @@ static TokenType reservedLookup (char * s)
 /****************************************/
 /* the primary function of the scanner  */
 /****************************************/
-/* function getToken returns the 
+/* function scanToken returns the 
  * next token in source file
  */
-TokenType getToken(void)
+static TokenType scanToken(Context * ctx)
 {  /* index for storing into tokenString */
    int tokenStringIndex = 0;
    /* holds current token to be returned */
    TokenType currentToken;
-   /* current state - always begins at START */
-   StateType state = START;
+   /* current state - begins at START unless the
+      scan stopped at the end of file in a comment */
+   StateType state = ctx->inComment ? INCOMMENT : START;
    /* flag to indicate save to tokenString */
    int save;
+   ctx->inComment = FALSE;
    while (state != DONE)
-   { int c = getNextChar();
+   { int c = getNextChar(ctx);
      save = TRUE;
      switch (state)
      { case START:
@@ -153,6 +160,7 @@ TokenType getToken(void)
          if (c == EOF) // 注释了一半遇到文件结束符，可以正常结束
          { state = DONE;
            currentToken = ENDFILE;
+           ctx->inComment = TRUE;
          }
          else if (c == '}') state = START; // 注释结束，重新开始
          break;
@@ -162,7 +170,7 @@ TokenType getToken(void)
            currentToken = ASSIGN;
          else
          { /* backup in the input */
-           ungetNextChar();
+           ungetNextChar(ctx);
            save = FALSE;
            currentToken = ERROR; // 出现单独的冒号是错误
          }
@@ -170,7 +178,7 @@ TokenType getToken(void)
        case INNUM:
          if (!isdigit(c))
          { /* backup in the input */
-           ungetNextChar();
+           ungetNextChar(ctx);
            save = FALSE;
            state = DONE;
            currentToken = NUM;
@@ -179,7 +187,7 @@ TokenType getToken(void)
        case INID:
          if (!isalpha(c))
          { /* backup in the input */
-           ungetNextChar();
+           ungetNextChar(ctx);
            save = FALSE;
            state = DONE;
            currentToken = ID;
@@ -188,28 +196,411 @@ TokenType getToken(void)
        case DONE: // 错误处理，状态DONE/ERROR都会匹配到这里
        // 出错处理步骤：(1)打印信息；(2)返回类型为ERROR
        default: /* should never happen */
-         fprintf(listing,"Scanner Bug: state= %d\n",state);
+         fprintf(ctx->listing,"Scanner Bug: state= %d\n",state);
          state = DONE;
          currentToken = ERROR;
          break;
      }
      // 把字符保存起来
      if ((save) && (tokenStringIndex <= MAXTOKENLEN))
-       tokenString[tokenStringIndex++] = (char) c;
+       ctx->tokenString[tokenStringIndex++] = (char) c;
      // 如果是结束状态，加上结束符形成一个完整的字符串
      if (state == DONE)
-     { tokenString[tokenStringIndex] = '\0';
+     { ctx->tokenString[tokenStringIndex] = '\0';
        // 对保留字问题做处理
        if (currentToken == ID)
-         currentToken = reservedLookup(tokenString);
+         currentToken = reservedLookup(ctx->tokenString);
      }
    }
+   ctx->ntokens++;
    // 打印调试信息
    if (TraceScan) {
-     fprintf(listing,"\t%d: ",lineno);
-     printToken(currentToken,tokenString);
+     fprintf(ctx->listing,"\t%d: ",ctx->lineno);
+     printToken(ctx,currentToken,ctx->tokenString);
    }
-   // 返回值是token的类型，但ID/NUM需要得到token的值，可以另外到全局变量tokenString[]处取
+   // 返回值是token的类型，但ID/NUM需要得到token的值，可以另外到ctx->tokenString[]处取
    return currentToken;
-} /* end getToken */
+} /* end scanToken */
+
+/****************************************/
+/* the scanner running on its own thread */
+/****************************************/
+// 扫描线程和语法分析线程之间是单生产者单消费者的环形队列，只用两个原子下标同步：
+// 扫描线程写好一格后才推进tail，分析线程取走一格后才推进head。
+// 扫描时的列表输出（源程序回显和TraceScan）先写到内存中，随token一起传过去，
+// 分析线程取token时再写出，所以列表和不用线程时一字不差
+
+/* PIPESLOTS = the number of tokens the scanner
+ * thread may run ahead of the parser
+ */
+#define PIPESLOTS 4096
+
+/* SPINS = the number of times a thread polls
+ * the ring before yielding the processor
+ */
+#define SPINS 64
+
+/* a token passed to the parser */
+typedef struct
+   { TokenType token;
+     int lineno; /* ctx->lineno when it was scanned */
+     char tokenString[MAXTOKENLEN+1];
+     char * text; /* listing output while scanning it, NULL if none */
+     size_t textLen;
+   } PipeSlot;
+
+/* the ring between the scanner thread and the
+ * parser; head and tail count tokens taken and
+ * put, and are kept on separate cache lines
+ */
+typedef struct scanPipeRec
+   { Context scan; /* the state of the scanner thread */
+     char * listBuf; /* scan.listing collects the output for a token */
+     size_t listLen;
+     pthread_t thread;
+     atomic_int stop; /* TRUE makes the scanner thread quit */
+     char pad1[64];
+     atomic_uint head; /* written by the parser only */
+     char pad2[64];
+     atomic_uint tail; /* written by the scanner thread only */
+     char pad3[64];
+     PipeSlot ring[PIPESLOTS];
+   } ScanPipe;
+
+/* Procedure backoff waits a little for the other
+ * thread, yielding once spun SPINS times
+ */
+static void backoff(int * spins)
+{ if (++*spins > SPINS) sched_yield(); }
+
+/* Procedure copyScanState copies the input
+ * buffer and state of the scanner from from to to
+ */
+static void copyScanState(Context * to, Context * from)
+{ memcpy(to->lineBuf,from->lineBuf,BUFLEN);
+  to->linepos = from->linepos;
+  to->bufsize = from->bufsize;
+  to->EOF_flag = from->EOF_flag;
+  to->inComment = from->inComment;
+}
+
+/* Function scanThread is the body of the
+ * scanner thread: it scans up to the end of
+ * file, waiting while the ring is full
+ */
+static void * scanThread(void * arg)
+{ ScanPipe * p = (ScanPipe *) arg;
+  Context * scan = &p->scan;
+  unsigned tail = 0;
+  TokenType token;
+  do
+  { PipeSlot * s;
+    int spins = 0;
+    token = scanToken(scan);
+    while (tail - atomic_load_explicit(&p->head,memory_order_acquire) == PIPESLOTS)
+    { if (atomic_load_explicit(&p->stop,memory_order_relaxed)) return NULL;
+      backoff(&spins);
+    }
+    s = &p->ring[tail % PIPESLOTS];
+    s->token = token;
+    s->lineno = scan->lineno;
+    strcpy(s->tokenString,scan->tokenString);
+    fflush(scan->listing);
+    s->text = NULL;
+    s->textLen = p->listLen;
+    if (p->listLen > 0)
+    { s->text = (char *) malloc(p->listLen);
+      memcpy(s->text,p->listBuf,p->listLen);
+      rewind(scan->listing);
+    }
+    atomic_store_explicit(&p->tail,++tail,memory_order_release);
+  } while ((token != ENDFILE) && ! atomic_load_explicit(&p->stop,memory_order_relaxed));
+  return NULL;
+}
+
+void startScanner(Context * ctx)
+{ ScanPipe * p;
+  /* with one processor the threads would only take turns */
+  if (sysconf(_SC_NPROCESSORS_ONLN) < 2) return;
+  p = (ScanPipe *) calloc(1,sizeof(ScanPipe));
+  if (p == NULL) return;
+  p->scan.source = ctx->source;
+  p->scan.listing = open_memstream(&p->listBuf,&p->listLen);
+  p->scan.lineno = ctx->lineno;
+  copyScanState(&p->scan,ctx);
+  atomic_init(&p->stop,FALSE);
+  atomic_init(&p->head,0);
+  atomic_init(&p->tail,0);
+  if (pthread_create(&p->thread,NULL,scanThread,p) != 0)
+  { fclose(p->scan.listing);
+    free(p->listBuf);
+    free(p);
+    return;
+  }
+  ctx->allocBytes += sizeof(ScanPipe);
+  ctx->pipe = p;
+}
+
+static void freeLexed(Context * ctx);
+
+void stopScanner(Context * ctx)
+{ ScanPipe * p = ctx->pipe;
+  unsigned i, tail;
+  if (ctx->lexed != NULL) freeLexed(ctx);
+  if (p == NULL) return;
+  atomic_store(&p->stop,TRUE);
+  pthread_join(p->thread,NULL);
+  /* the tokens the parser did not take were never scanned */
+  tail = atomic_load(&p->tail);
+  for (i=atomic_load(&p->head);i != tail;i++)
+    free(p->ring[i % PIPESLOTS].text);
+  copyScanState(ctx,&p->scan);
+  fclose(p->scan.listing);
+  free(p->listBuf);
+  free(p);
+  ctx->pipe = NULL;
+}
+
+/* Function pipeToken takes the next token from
+ * the scanner thread, first writing the listing
+ * output made while scanning it
+ */
+static TokenType pipeToken(Context * ctx)
+{ ScanPipe * p = ctx->pipe;
+  unsigned head = atomic_load_explicit(&p->head,memory_order_relaxed);
+  PipeSlot * s;
+  TokenType token;
+  int spins = 0;
+  while (atomic_load_explicit(&p->tail,memory_order_acquire) == head)
+    backoff(&spins);
+  s = &p->ring[head % PIPESLOTS];
+  if (s->text != NULL)
+  { fwrite(s->text,1,s->textLen,ctx->listing);
+    free(s->text);
+  }
+  token = s->token;
+  ctx->lineno = s->lineno;
+  strcpy(ctx->tokenString,s->tokenString);
+  atomic_store_explicit(&p->head,head+1,memory_order_release);
+  ctx->ntokens++;
+  /* any further calls scan on this thread, as before */
+  if (token == ENDFILE) stopScanner(ctx);
+  return token;
+}
+
+/****************************************/
+/* lexing large sources in parallel     */
+/****************************************/
+// 把映射到内存的源文件在行首切成几块，每块在自己的线程中用同一个扫描器
+// 从START状态推测地扫描。块的边界只可能落在注释中间（token不跨行；
+// 含NUL的行读不到行尾的换行符，不在这样的行后切），
+// 前一块若停在未结束的注释中，这一块就从INCOMMENT状态重新扫描。
+// 各块的行号从0数起，拼接时加上前面各块读过的行数
+
+/* MINCHUNK = the fewest bytes of source lexed
+ * by a thread
+ */
+#define MINCHUNK 65536
+
+/* a token lexed ahead */
+typedef struct
+   { TokenType token;
+     int lineno; /* within its chunk */
+     int text; /* offset of its tokenString in the text of its chunk */
+   } Lexeme;
+
+/* a chunk of the source, which begins at the
+ * start of a line
+ */
+typedef struct
+   { Context scan; /* the state of the scanner of the chunk */
+     char * start;
+     size_t len;
+     Lexeme * lexeme; /* the tokens of the chunk, ENDFILE not included */
+     int nlexemes, maxlexemes;
+     char * text; /* their tokenStrings */
+     int ntext, maxtext;
+     int lines; /* source lines before the chunk */
+     int nlines; /* source lines in it */
+     pthread_t thread;
+     int threaded; /* TRUE if lexed on a thread of its own */
+   } Chunk;
+
+typedef struct lexedRec
+   { char * map; /* the mapped source file */
+     size_t mapLen;
+     Chunk * chunk;
+     int nchunks;
+     int cur; /* the chunk of the next token */
+     int next; /* the next token in it */
+   } Lexed;
+
+/* Procedure addLexeme appends the token just
+ * scanned to chunk c
+ */
+static void addLexeme(Chunk * c, TokenType token)
+{ int len = strlen(c->scan.tokenString) + 1;
+  Lexeme * l;
+  if (c->nlexemes == c->maxlexemes)
+  { c->maxlexemes = c->maxlexemes ? 2*c->maxlexemes : 1024;
+    c->lexeme = (Lexeme *) realloc(c->lexeme,c->maxlexemes*sizeof(Lexeme));
+  }
+  if (c->ntext + len > c->maxtext)
+  { c->maxtext = c->maxtext ? 2*c->maxtext : 4096;
+    c->text = (char *) realloc(c->text,c->maxtext);
+  }
+  l = &c->lexeme[c->nlexemes++];
+  l->token = token;
+  l->lineno = c->scan.lineno;
+  l->text = c->ntext;
+  memcpy(c->text+c->ntext,c->scan.tokenString,len);
+  c->ntext += len;
+}
+
+/* Function lexChunk scans chunk c up to its end,
+ * inside a comment from the start if
+ * c->scan.inComment is set; c->scan.inComment
+ * then tells if it ended inside a comment
+ */
+static void * lexChunk(void * arg)
+{ Chunk * c = (Chunk *) arg;
+  Context * scan = &c->scan;
+  TokenType token;
+  int inComment = scan->inComment;
+  c->nlexemes = c->ntext = 0;
+  scan->source = fmemopen(c->start,c->len,"r");
+  scan->lineno = 0;
+  resetScanner(scan);
+  scan->inComment = inComment;
+  c->nlines = -1;
+  do
+  { token = scanToken(scan);
+    if (token != ENDFILE) addLexeme(c,token);
+    /* lineno counts the end of file once, then on every getNextChar */
+    if (scan->EOF_flag && (c->nlines < 0)) c->nlines = scan->lineno - 1;
+  } while (token != ENDFILE);
+  fclose(scan->source);
+  scan->source = NULL;
+  return NULL;
+}
+
+/* Function endsLine returns TRUE if the scanner
+ * reads a newline just before cut, which it does
+ * not if the line has a NUL character; start is
+ * the start of the chunk
+ */
+static int endsLine(char * start, char * cut)
+{ char * q = cut-1;
+  if ((cut == start) || (*q != '\n')) return FALSE;
+  while ((q > start) && (q[-1] != '\n'))
+    if (*--q == '\0') return FALSE;
+  return TRUE;
+}
+
+int scanParallel(Context * ctx, int nthreads)
+{ struct stat st;
+  long offset;
+  int fd, k, n;
+  char * map, * p, * end;
+  Lexed * l;
+  if ((nthreads < 2) || EchoSource || TraceScan) return FALSE;
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > n) nthreads = n;
+  if ((fd = fileno(ctx->source)) < 0) return FALSE;
+  if ((fstat(fd,&st) != 0) || ! S_ISREG(st.st_mode)) return FALSE;
+  if ((offset = ftell(ctx->source)) < 0) return FALSE;
+  n = (st.st_size - offset) / MINCHUNK;
+  if (n > nthreads) n = nthreads;
+  if (n < 2) return FALSE;
+  map = (char *) mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  if (map == MAP_FAILED) return FALSE;
+  l = (Lexed *) calloc(1,sizeof(Lexed));
+  l->map = map;
+  l->mapLen = st.st_size;
+  l->chunk = (Chunk *) calloc(n,sizeof(Chunk));
+  ctx->allocBytes += sizeof(Lexed) + n*sizeof(Chunk);
+  /* cut after the first newline past each even share */
+  p = map + offset;
+  end = map + st.st_size;
+  for (k=0;(k < n) && (p < end);k++)
+  { char * cut = (k == n-1) ? end : map + offset + (k+1)*((end-map-offset)/n);
+    if (cut < p) cut = p;
+    while ((cut < end) && ! endsLine(p,cut)) cut++;
+    l->chunk[k].start = p;
+    l->chunk[k].len = cut - p;
+    l->chunk[k].scan.listing = ctx->listing;
+    p = cut;
+  }
+  l->nchunks = k;
+  /* guess that every chunk begins outside a comment */
+  for (k=1;k<l->nchunks;k++)
+    l->chunk[k].threaded =
+      (pthread_create(&l->chunk[k].thread,NULL,lexChunk,&l->chunk[k]) == 0);
+  lexChunk(&l->chunk[0]);
+  for (k=1;k<l->nchunks;k++)
+    if (l->chunk[k].threaded) pthread_join(l->chunk[k].thread,NULL);
+    else lexChunk(&l->chunk[k]);
+  /* rescan the chunks that did not, and count the lines */
+  for (k=1;k<l->nchunks;k++)
+  { Chunk * prev = &l->chunk[k-1];
+    if (prev->scan.inComment)
+    { l->chunk[k].scan.inComment = TRUE;
+      lexChunk(&l->chunk[k]);
+    }
+    l->chunk[k].lines = prev->lines + prev->nlines;
+  }
+  for (k=0;k<l->nchunks;k++)
+    ctx->allocBytes += l->chunk[k].maxlexemes*sizeof(Lexeme) + l->chunk[k].maxtext;
+  ctx->lexed = l;
+  return TRUE;
+}
+
+/* Procedure freeLexed releases the tokens lexed
+ * in parallel
+ */
+static void freeLexed(Context * ctx)
+{ Lexed * l = ctx->lexed;
+  int k;
+  for (k=0;k<l->nchunks;k++)
+  { free(l->chunk[k].lexeme);
+    free(l->chunk[k].text);
+  }
+  free(l->chunk);
+  munmap(l->map,l->mapLen);
+  free(l);
+  ctx->lexed = NULL;
+}
+
+/* Function lexedToken returns the next token
+ * lexed in parallel; at the end of file the
+ * scanner is left as if it had scanned it all
+ */
+static TokenType lexedToken(Context * ctx)
+{ Lexed * l = ctx->lexed;
+  Chunk * c = &l->chunk[l->cur];
+  Lexeme * x;
+  while ((l->next == c->nlexemes) && (l->cur < l->nchunks-1))
+  { c = &l->chunk[++l->cur];
+    l->next = 0;
+  }
+  ctx->ntokens++;
+  if (l->next == c->nlexemes)
+  { copyScanState(ctx,&c->scan);
+    ctx->lineno = c->lines + c->scan.lineno;
+    ctx->tokenString[0] = '\0';
+    fseek(ctx->source,0,SEEK_END);
+    freeLexed(ctx);
+    return ENDFILE;
+  }
+  x = &c->lexeme[l->next++];
+  ctx->lineno = c->lines + x->lineno;
+  strcpy(ctx->tokenString,c->text+x->text);
+  return x->token;
+}
+
+TokenType getToken(Context * ctx)
+{ if (ctx->lexed != NULL) return lexedToken(ctx);
+  if (ctx->pipe != NULL) return pipeToken(ctx);
+  return scanToken(ctx);
+}
 
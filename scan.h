@@ -8,20 +8,51 @@
 #ifndef _SCAN_H_
 #define _SCAN_H_
 
-/* MAXTOKENLEN is the maximum size of a token */
-#define MAXTOKENLEN 40
-
 // 两条返回路径，token的类型通过函数返回值告知
-// token的值通过全局变量传递（只有id/num两种类型要用到）
-
-/* tokenString array stores the lexeme of each token */
-// 变量声明，将这个全局变量的作用域扩展到其他文件
-extern char tokenString[MAXTOKENLEN+1];
+// token的值通过ctx->tokenString传递（只有id/num两种类型要用到）
+// MAXTOKENLEN与tokenString都已移入globals.h的Context中
 
 /* function getToken returns the 
- * next token in source file
+ * next token in source file; the lexeme
+ * is left in ctx->tokenString
  */
 // 函数声明，一次返回一个token
-TokenType getToken(void);
+TokenType getToken(Context *);
+
+/* Procedure resetScanner discards any buffered
+ * input so that a new source file can be scanned
+ */
+void resetScanner(Context *);
+
+/* Procedure startScanner starts scanning the
+ * source of ctx ahead of the parser on a thread of
+ * its own; getToken then takes the tokens from a
+ * bounded lock-free ring, and the listing output
+ * of the scanner appears just as without the
+ * thread. The scanner stays on the parser's
+ * thread if there is only one processor or no
+ * thread can be started
+ */
+void startScanner(Context *);
+
+/* Procedure stopScanner stops the scanner thread
+ * of ctx, if any, discarding the tokens scanned
+ * ahead, and discards the tokens left by
+ * scanParallel; getToken stops both by itself at
+ * the end of file
+ */
+void stopScanner(Context *);
+
+/* Function scanParallel lexes the whole source
+ * of ctx up front, splitting it into chunks
+ * lexed on up to nthreads threads; getToken then
+ * returns the tokens lexed, which are the same
+ * as those scanned one at a time. It returns
+ * FALSE, lexing nothing, unless the source is a
+ * large regular file, the scanner prints no
+ * listing output and there are processors to
+ * spare
+ */
+int scanParallel(Context *, int nthreads);
 
 #endif
@@ -1,9 +1,10 @@
 /****************************************************/
 /* File: symtab.c                                   */
 /* Symbol table implementation for the TINY compiler*/
-/* (allows only one symbol table)                   */
-/* Symbol table is implemented as a chained         */
-/* hash table                                       */
+/* (one symbol table per compilation context)       */
+/* Symbol table is implemented as an open           */
+/* addressing hash table over a dense array of      */
+/* entries; an entry's index is its handle          */
 /* Compiler Construction: Principles and Practice   */
 /* Kenneth C. Louden                                */
 /****************************************************/
@@ -13,115 +14,345 @@
 #include <string.h>
 #include "symtab.h"
 
-// 实现哈希+链表的插入+查询功能，不过寥寥百行而已
+// 开放定址哈希表：槽里只存条目下标，条目本身按插入顺序存放在数组中，
+// 所以条目下标（句柄）在扩容后仍然有效
 
-/* SIZE is the size of the hash table */
-#define SIZE 211
+/* INITSIZE is the initial number of hash slots
+   (always a power of two) */
+#define INITSIZE 64
 
-/* SHIFT is the power of two used as multiplier
-   in hash function  */
-#define SHIFT 4
-
-/* the hash function */
-static int hash ( char * key )
-{ int temp = 0;
+/* the hash function (32-bit FNV-1a) */
+static unsigned hash ( char * key )
+{ unsigned temp = 2166136261u;
   int i = 0;
   while (key[i] != '\0')
-  { temp = ((temp << SHIFT) + key[i]) % SIZE;
+  { temp = (temp ^ (unsigned char) key[i]) * 16777619u;
     ++i;
   }
   return temp;
 }
 
-/* the list of line numbers of the source 
- * code in which a variable is referenced
+/* the line numbers of the source code in which
+ * a variable is referenced are appended to a list
+ * of chunks; each chunk holds twice as many line
+ * numbers as the one before it
  */
-typedef struct LineListRec
-   { int lineno;
-     struct LineListRec * next;
-   } * LineList;
+// 追加只需写入最后一个块，O(1)；不再每个引用malloc一个结点
+typedef struct LineChunkRec
+   { struct LineChunkRec * next;
+     int n, size; /* used and allocated line numbers */
+     int lineno[1]; /* really size entries */
+   } * LineChunk;
+
+/* FIRSTCHUNK is the size of the first chunk */
+#define FIRSTCHUNK 4
 
-/* The record in the bucket lists for
- * each variable, including name, 
- * assigned memory location, and
+/* The record for each variable, including
+ * name, assigned memory location, and
  * the list of line numbers in which
  * it appears in the source code
  */
-typedef struct BucketListRec
+// 冻结后，行号改存为相邻行号之差的变长编码（见st_freeze）
+typedef struct
    { char * name;
-     LineList lines;
+     unsigned hash; /* full hash of name */
+     LineChunk first, last; /* line numbers, while growing */
+     unsigned char * packed; /* line numbers, once frozen */
+     int nlines; /* number of line numbers */
      int memloc ; /* memory location for variable */
-     struct BucketListRec * next;
-   } * BucketList;
+   } Entry;
+
+/* the symbol table: slot[] holds handle+1 of
+ * the entry hashed there (0 = empty slot)
+ */
+struct symTableRec
+   { int * slot;
+     int nslots; /* power of two */
+     Entry * entry; /* entries in order of insertion */
+     int count, size; /* used and allocated entries */
+     long bytes; /* bytes allocated for the table */
+   };
 
-/* the hash table */
-// 哈希表是作为全局变量存储，没有extern
-// 但是代码生成模块会用到lookup函数
-// 所以实际上是共享的
-static BucketList hashTable[SIZE];
+/* Function st_new allocates a new, empty
+ * symbol table
+ */
+SymTable st_new( void )
+{ SymTable tab = (SymTable) calloc(1,sizeof(struct symTableRec));
+  if (tab == NULL) return NULL;
+  tab->nslots = INITSIZE;
+  tab->slot = (int *) calloc(INITSIZE,sizeof(int));
+  tab->bytes = INITSIZE*sizeof(int);
+  return tab;
+}
 
-/* Procedure st_insert inserts line numbers and
- * memory locations into the symbol table
+/* Procedure st_free releases a symbol table
+ * and all of its entries
+ */
+void st_free( SymTable tab )
+{ if (tab == NULL) return;
+  st_reset(tab);
+  free(tab->slot);
+  free(tab->entry);
+  free(tab);
+}
+
+/* Function probe returns the slot holding name
+ * (with hash h), or the empty slot where it
+ * would be inserted
+ */
+// 线性探查，先比较完整的哈希值，相同时才比较字符串
+static unsigned probe( SymTable tab, char * name, unsigned h )
+{ unsigned mask = tab->nslots - 1;
+  unsigned i = h & mask;
+  while (tab->slot[i] != 0)
+  { Entry * e = &tab->entry[tab->slot[i]-1];
+    if ((e->hash == h) && (strcmp(name,e->name) == 0)) break;
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/* Procedure grow doubles the number of hash
+ * slots and rehashes all entries
+ */
+static void grow( SymTable tab )
+{ int n = 2*tab->nslots;
+  unsigned mask = n - 1;
+  int k;
+  free(tab->slot);
+  tab->slot = (int *) calloc(n,sizeof(int));
+  tab->bytes += (n - tab->nslots)*sizeof(int);
+  tab->nslots = n;
+  for (k=0;k<tab->count;k++)
+  { unsigned i = tab->entry[k].hash & mask;
+    while (tab->slot[i] != 0) i = (i + 1) & mask;
+    tab->slot[i] = k+1;
+  }
+}
+
+/* Function newChunk allocates a line number
+ * chunk with room for size line numbers
+ */
+static LineChunk newChunk( SymTable tab, int size )
+{ int n = sizeof(struct LineChunkRec) + (size-1)*sizeof(int);
+  LineChunk c = (LineChunk) malloc(n);
+  tab->bytes += n;
+  c->next = NULL;
+  c->n = 0;
+  c->size = size;
+  return c;
+}
+
+/* Procedure freeLines releases the line
+ * numbers of entry e
+ */
+static void freeLines( Entry * e )
+{ LineChunk c = e->first;
+  while (c != NULL)
+  { LineChunk cnext = c->next;
+    free(c);
+    c = cnext;
+  }
+  free(e->packed);
+  e->first = e->last = NULL;
+  e->packed = NULL;
+}
+
+/* Function getVarint decodes the next line number
+ * delta at *p (seven bits per byte, low bits first,
+ * sign folded into bit 0) and advances *p past it
+ */
+static int getVarint( unsigned char ** p )
+{ unsigned v = 0;
+  int shift = 0;
+  while (**p & 0x80)
+  { v |= (unsigned) (*(*p)++ & 0x7f) << shift;
+    shift += 7;
+  }
+  v |= (unsigned) *(*p)++ << shift;
+  return (v & 1) ? -(int) (v >> 1) - 1 : (int) (v >> 1);
+}
+
+/* Procedure thaw turns the packed line numbers
+ * of e back into a single chunk so that more
+ * can be appended
+ */
+static void thaw( SymTable tab, Entry * e )
+{ unsigned char * p = e->packed;
+  int k, lineno = 0;
+  LineChunk c = newChunk(tab,e->nlines > FIRSTCHUNK ? 2*e->nlines : FIRSTCHUNK);
+  for (k=0;k<e->nlines;k++)
+  { lineno += getVarint(&p);
+    c->lineno[c->n++] = lineno;
+  }
+  tab->bytes -= p - e->packed;
+  free(e->packed);
+  e->packed = NULL;
+  e->first = e->last = c;
+}
+
+/* Procedure addLine appends lineno to the
+ * line numbers of e
+ */
+static void addLine( SymTable tab, Entry * e, int lineno )
+{ if (e->packed != NULL) thaw(tab,e);
+  if (e->last == NULL)
+    e->first = e->last = newChunk(tab,FIRSTCHUNK);
+  else if (e->last->n == e->last->size) // 最后一块已满，接上一块两倍大的
+  { e->last->next = newChunk(tab,2*e->last->size);
+    e->last = e->last->next;
+  }
+  e->last->lineno[e->last->n++] = lineno;
+  e->nlines++;
+}
+
+/* Function st_insert finds name, inserting it if
+ * not yet in the table, and adds lineno to its
+ * line numbers, all in one probe sequence.
  * loc = memory location is inserted only the
- * first time, otherwise ignored
- */
-void st_insert( char * name, int lineno, int loc )
-{ int h = hash(name);
-  BucketList l =  hashTable[h]; // 从哈希表的某一项拿出链表
-  while ((l != NULL) && (strcmp(name,l->name) != 0)) // 在哈希表项链表里找某个符号的链表
-    l = l->next;
-  if (l == NULL) /* variable not yet in table */
-  { l = (BucketList) malloc(sizeof(struct BucketListRec));
-    l->name = name;
-    l->lines = (LineList) malloc(sizeof(struct LineListRec));
-    l->lines->lineno = lineno;
-    l->memloc = loc; // 记录下位置号
-    l->lines->next = NULL;
-    l->next = hashTable[h];
-    hashTable[h] = l; }
-  else /* found in table, so just add line number */
-  { LineList t = l->lines;
-    while (t->next != NULL) t = t->next; // 走到链表最末端
-    t->next = (LineList) malloc(sizeof(struct LineListRec));
-    t->next->lineno = lineno;
-    t->next->next = NULL;
+ * first time, otherwise ignored.
+ * Returns the handle of the symbol
+ */
+int st_insert( SymTable tab, char * name, int lineno, int loc )
+{ unsigned h = hash(name);
+  unsigned i = probe(tab,name,h);
+  Entry * e;
+  if (tab->slot[i] == 0) /* variable not yet in table */
+  { if (tab->count >= tab->size)
+    { int n = tab->size ? 2*tab->size : 16;
+      tab->entry = (Entry *) realloc(tab->entry,n*sizeof(Entry));
+      tab->bytes += (n - tab->size)*sizeof(Entry);
+      tab->size = n;
+    }
+    e = &tab->entry[tab->count];
+    /* the syntax tree node holding name may be freed by later passes */
+    e->name = (char *) malloc(strlen(name)+1);
+    strcpy(e->name,name);
+    tab->bytes += strlen(name)+1;
+    e->hash = h;
+    e->first = e->last = NULL;
+    e->packed = NULL;
+    e->nlines = 0;
+    e->memloc = loc; // 记录下位置号
+    tab->slot[i] = ++tab->count;
+    if (4*tab->count > 3*tab->nslots) grow(tab); // 装填因子超过3/4时扩容
   }
+  else /* found in table, so just add line number */
+    e = &tab->entry[tab->slot[i]-1];
+  addLine(tab,e,lineno);
+  return e - tab->entry;
 } /* st_insert */
 
-/* Function st_lookup returns the memory 
- * location of a variable or -1 if not found
+/* Function putVarint encodes delta d at p in the
+ * format read by getVarint, or only counts the
+ * bytes when p is NULL; returns the byte count
  */
-int st_lookup ( char * name )
-{ int h = hash(name);
-  BucketList l =  hashTable[h]; // 从哈希表的某一项拿出链表
-  while ((l != NULL) && (strcmp(name,l->name) != 0)) // 在哈希表项链表里找某个符号的链表
-    l = l->next;
-  if (l == NULL) return -1;
-  else return l->memloc; // 返回的是位置号
+static int putVarint( unsigned char * p, int d )
+{ unsigned v = d < 0 ? ((unsigned) (-(d+1)) << 1) | 1 : (unsigned) d << 1;
+  int n = 1;
+  while (v >= 0x80)
+  { if (p != NULL) *p++ = (unsigned char) (v | 0x80);
+    v >>= 7;
+    n++;
+  }
+  if (p != NULL) *p = (unsigned char) v;
+  return n;
 }
 
+/* Procedure st_freeze packs the line numbers of
+ * every symbol as varint-encoded deltas from the
+ * previous line number; later insertions unpack
+ * the symbol again
+ */
+// 同一变量的行号基本递增，差值通常只占一个字节
+void st_freeze( SymTable tab )
+{ int k;
+  for (k=0;k<tab->count;++k)
+  { Entry * e = &tab->entry[k];
+    LineChunk c;
+    unsigned char * buf;
+    int i, prev, n = 0;
+    if (e->packed != NULL) continue;
+    prev = 0;
+    for (c=e->first;c!=NULL;c=c->next) // 先算出编码后的长度
+      for (i=0;i<c->n;i++)
+      { n += putVarint(NULL,c->lineno[i]-prev);
+        prev = c->lineno[i];
+      }
+    buf = (unsigned char *) malloc(n);
+    n = 0; prev = 0;
+    for (c=e->first;c!=NULL;c=c->next)
+    { for (i=0;i<c->n;i++)
+      { n += putVarint(buf+n,c->lineno[i]-prev);
+        prev = c->lineno[i];
+      }
+      tab->bytes -= sizeof(struct LineChunkRec) + (c->size-1)*sizeof(int);
+    }
+    tab->bytes += n;
+    freeLines(e);
+    e->packed = buf;
+  }
+} /* st_freeze */
+
+/* Function st_loc returns the memory location
+ * of the symbol with handle h
+ */
+int st_loc( SymTable tab, int h )
+{ return tab->entry[h].memloc; }
+
+/* Function st_count returns the number of
+ * symbols in the table
+ */
+int st_count( SymTable tab )
+{ return tab->count; }
+
 /* Procedure printSymTab prints a formatted 
  * listing of the symbol table contents 
  * to the listing file
  */
-void printSymTab(FILE * listing)
-{ int i;
+void printSymTab( SymTable tab, FILE * listing )
+{ int k;
   fprintf(listing,"Variable Name  Location   Line Numbers\n");
   fprintf(listing,"-------------  --------   ------------\n");
-  for (i=0;i<SIZE;++i)
-  { if (hashTable[i] != NULL)
-    { BucketList l = hashTable[i];
-      while (l != NULL)
-      { LineList t = l->lines;
-        fprintf(listing,"%-14s ",l->name);
-        fprintf(listing,"%-8d  ",l->memloc);
-        while (t != NULL)
-        { fprintf(listing,"%4d ",t->lineno);
-          t = t->next;
-        }
-        fprintf(listing,"\n");
-        l = l->next;
+  for (k=0;k<tab->count;++k)
+  { Entry * e = &tab->entry[k];
+    fprintf(listing,"%-14s ",e->name);
+    fprintf(listing,"%-8d  ",e->memloc);
+    if (e->packed != NULL)
+    { unsigned char * p = e->packed;
+      int i, lineno = 0;
+      for (i=0;i<e->nlines;i++)
+      { lineno += getVarint(&p);
+        fprintf(listing,"%4d ",lineno);
       }
     }
+    else
+    { LineChunk c;
+      int i;
+      for (c=e->first;c!=NULL;c=c->next)
+        for (i=0;i<c->n;i++)
+          fprintf(listing,"%4d ",c->lineno[i]);
+    }
+    fprintf(listing,"\n");
   }
 } /* printSymTab */
+
+/* Procedure st_reset removes all entries from
+ * the symbol table and releases their storage
+ */
+void st_reset( SymTable tab )
+{ int k;
+  for (k=0;k<tab->count;++k)
+  { freeLines(&tab->entry[k]);
+    free(tab->entry[k].name);
+  }
+  memset(tab->slot,0,tab->nslots*sizeof(int));
+  tab->count = 0;
+  tab->bytes = tab->nslots*sizeof(int) + tab->size*sizeof(Entry);
+} /* st_reset */
+
+/* Function st_bytes returns the number of bytes
+ * currently allocated by the symbol table
+ */
+long st_bytes( SymTable tab )
+{ return sizeof(struct symTableRec) + tab->bytes; }
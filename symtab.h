@@ -1,7 +1,7 @@
 /****************************************************/
 /* File: symtab.h                                   */
 /* Symbol table interface for the TINY compiler     */
-/* (allows only one symbol table)                   */
+/* (one symbol table per compilation context)       */
 /* Compiler Construction: Principles and Practice   */
 /* Kenneth C. Louden                                */
 /****************************************************/
@@ -9,22 +9,62 @@
 #ifndef _SYMTAB_H_
 #define _SYMTAB_H_
 
-/* Procedure st_insert inserts line numbers and
- * memory locations into the symbol table
+/* SymTable is a handle to one symbol table;
+ * each compilation context owns its own table
+ */
+typedef struct symTableRec * SymTable;
+
+/* Function st_new allocates a new, empty
+ * symbol table
+ */
+SymTable st_new( void );
+
+/* Procedure st_free releases a symbol table
+ * and all of its entries
+ */
+void st_free( SymTable tab );
+
+/* Function st_insert finds name, inserting it if
+ * not yet in the table, and adds lineno to its
+ * line numbers, all in one probe sequence.
  * loc = memory location is inserted only the
- * first time, otherwise ignored
+ * first time, otherwise ignored.
+ * Returns the handle of the symbol: handles are
+ * numbered consecutively from 0 in order of first
+ * insertion and stay valid until st_reset
+ */
+int st_insert( SymTable tab, char * name, int lineno, int loc );
+
+/* Procedure st_freeze compacts the line numbers
+ * of all symbols once the table is complete;
+ * st_insert may still be called afterwards
+ */
+void st_freeze( SymTable tab );
+
+/* Function st_loc returns the memory location
+ * of the symbol with handle h
  */
-void st_insert( char * name, int lineno, int loc );
+int st_loc( SymTable tab, int h );
 
-/* Function st_lookup returns the memory 
- * location of a variable or -1 if not found
+/* Function st_count returns the number of
+ * symbols in the table
  */
-int st_lookup ( char * name );
+int st_count( SymTable tab );
 
 /* Procedure printSymTab prints a formatted 
  * listing of the symbol table contents 
  * to the listing file
  */
-void printSymTab(FILE * listing);
+void printSymTab( SymTable tab, FILE * listing );
+
+/* Procedure st_reset removes all entries from
+ * the symbol table and releases their storage
+ */
+void st_reset( SymTable tab );
+
+/* Function st_bytes returns the number of bytes
+ * currently allocated by the symbol table
+ */
+long st_bytes( SymTable tab );
 
 #endif
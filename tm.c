@@ -82,11 +82,21 @@ int iloc = 0 ;
 int dloc = 0 ;
 int traceflag = FALSE;
 int icountflag = FALSE;
+int profileflag = FALSE;
 
 INSTRUCTION iMem [IADDR_SIZE];
 int dMem [DADDR_SIZE];
 int reg [NO_REGS];
 
+/* the profile: executions and taken jumps of each
+   location, and the compiler's profile sites
+   (site 0 = none, else site number + 1) */
+long iCount [IADDR_SIZE];
+long iTaken [IADDR_SIZE];
+int iSite [IADDR_SIZE];
+char iSense [IADDR_SIZE];
+int nSites = -1;
+
 char * opCodeTab[]
         = {"HALT","IN","OUT","ADD","SUB","MUL","DIV","????",
             /* RR opcodes */
@@ -100,7 +110,7 @@ char * stepResultTab[]
            "Data Memory Fault","Division by 0"
           };
 
-char pgmName[20];
+char pgmName[LINESIZE];
 FILE *pgm  ;
 
 char in_Line[LINESIZE] ;
@@ -241,7 +251,18 @@ int readInstructions (void)
     lineLen = strlen(in_Line)-1 ;
     if (in_Line[lineLen]=='\n') in_Line[lineLen] = '\0' ;
     else in_Line[++lineLen] = '\0';
-    if ( (nonBlank()) && (in_Line[inCol] != '*') )
+    if ( (nonBlank()) && (in_Line[inCol] == '*') )
+    { int site;
+      char sense;
+      /* the profile sites written by the compiler */
+      if (sscanf(in_Line,"* sites %d",&site) == 1) nSites = site;
+      else if ((sscanf(in_Line,"* site %d %d %c",&site,&loc,&sense) == 3)
+               && (loc >= 0) && (loc < IADDR_SIZE))
+      { iSite[loc] = site + 1;
+        iSense[loc] = sense;
+      }
+    }
+    else if ( nonBlank() )
     { if (! getNum())
         return error("Bad location", lineNo,-1);
       loc = num;
@@ -315,6 +336,7 @@ STEPRESULT stepTM (void)
       return srIMEM_ERR ;
   reg[PC_REG] = pc + 1 ;
   currentinstruction = iMem[ pc ] ;
+  iCount[pc]++ ;
   switch (opClass(currentinstruction.iop) )
   { case opclRR :
     /***********************************/
@@ -384,18 +406,52 @@ STEPRESULT stepTM (void)
     /*************** RA instructions ********************/
     case opLDA :    reg[r] = m ; break;
     case opLDC :    reg[r] = currentinstruction.iarg2 ;   break;
-    case opJLT :    if ( reg[r] <  0 ) reg[PC_REG] = m ; break;
-    case opJLE :    if ( reg[r] <=  0 ) reg[PC_REG] = m ; break;
-    case opJGT :    if ( reg[r] >  0 ) reg[PC_REG] = m ; break;
-    case opJGE :    if ( reg[r] >=  0 ) reg[PC_REG] = m ; break;
-    case opJEQ :    if ( reg[r] == 0 ) reg[PC_REG] = m ; break;
-    case opJNE :    if ( reg[r] != 0 ) reg[PC_REG] = m ; break;
+    case opJLT :    if ( reg[r] <  0 ) { reg[PC_REG] = m ; iTaken[pc]++ ; } break;
+    case opJLE :    if ( reg[r] <=  0 ) { reg[PC_REG] = m ; iTaken[pc]++ ; } break;
+    case opJGT :    if ( reg[r] >  0 ) { reg[PC_REG] = m ; iTaken[pc]++ ; } break;
+    case opJGE :    if ( reg[r] >=  0 ) { reg[PC_REG] = m ; iTaken[pc]++ ; } break;
+    case opJEQ :    if ( reg[r] == 0 ) { reg[PC_REG] = m ; iTaken[pc]++ ; } break;
+    case opJNE :    if ( reg[r] != 0 ) { reg[PC_REG] = m ; iTaken[pc]++ ; } break;
 
     /* end of legal instructions */
   } /* case */
   return srOKAY ;
 } /* stepTM */
 
+/********************************************/
+/* writes the counts to the profile file for  */
+/* the compiler (tiny -fprofile-use)          */
+void writeProfile (void)
+{ char profName[LINESIZE+8];
+  FILE * prof;
+  char * dot, * slash;
+  int loc;
+  strcpy(profName,pgmName);
+  dot = strrchr(profName,'.');
+  slash = strrchr(profName,'/');
+  if ((dot != NULL) && ((slash == NULL) || (dot > slash)))
+    *dot = '\0'; /* a dot in a directory name is not an extension */
+  strcat(profName,".prof");
+  prof = fopen(profName,"w");
+  if (prof == NULL)
+  { printf("cannot write profile '%s'\n",profName);
+    return;
+  }
+  fprintf(prof,"* TM profile of %s\n",pgmName);
+  if (nSites >= 0) fprintf(prof,"sites %d\n",nSites);
+  fprintf(prof,"* loc <location> <executed> <jumps taken>\n");
+  for (loc = 0 ; loc < IADDR_SIZE ; loc++)
+    if (iCount[loc] > 0)
+      fprintf(prof,"loc %d %ld %ld\n",loc,iCount[loc],iTaken[loc]);
+  fprintf(prof,"* site <site> <taken if t(rue)/f(alse)> <executed> <jumps taken>\n");
+  for (loc = 0 ; loc < IADDR_SIZE ; loc++)
+    if (iSite[loc] > 0)
+      fprintf(prof,"site %d %c %ld %ld\n",iSite[loc]-1,iSense[loc],
+              iCount[loc],iTaken[loc]);
+  fclose(prof);
+  printf("Profile written to %s\n",profName);
+} /* writeProfile */
+
 /********************************************/
 int doCommand (void)
 { char cmd;
@@ -558,8 +614,13 @@ int doCommand (void)
 /********************************************/
 
 main( int argc, char * argv[] )
-{ if (argc != 2)
-  { printf("usage: %s <filename>\n",argv[0]);
+{ if ((argc == 3) && (strcmp(argv[1],"-p") == 0))
+  { profileflag = TRUE;
+    argc--;
+    argv++;
+  }
+  if ((argc != 2) || (strlen(argv[1]) > LINESIZE-4))
+  { printf("usage: %s [-p] <filename>\n",argv[0]);
     exit(1);
   }
   strcpy(pgmName,argv[1]) ;
@@ -581,6 +642,7 @@ main( int argc, char * argv[] )
   do
      done = ! doCommand ();
   while (! done );
+  if ( profileflag ) writeProfile ();
   printf("Simulation done.\n");
   return 0;
 }
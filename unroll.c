@@ -0,0 +1,221 @@
+/****************************************************/
+/* File: unroll.c                                   */
+/* Unrolling of counted repeat loops on the syntax */
+/* tree for the TINY compiler                       */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#include "globals.h"
+#include "util.h"
+#include "fold.h"
+#include "profile.h"
+#include "unroll.h"
+
+// 计数循环：循环前一句把计数器置为常数，循环体中只有顶层的一句给它加常数，
+// 测试是计数器和常数比较。编译时按TM的32位回绕运算模拟计数器就得到循环次数n。
+// 循环体复制k份后测试仍用原来的：少做的那些测试原本都是假，
+// 所以先在循环前执行n%k次循环体，余下的n/k次每次执行k份
+
+/* MAXTRIPS bounds the iterations simulated to
+ * find the trip count of a loop
+ */
+#define MAXTRIPS 1000000
+
+/* MAXUNROLLED = the most syntax tree nodes in the
+ * body of an unrolled loop or in the copies that
+ * replace a loop
+ */
+#define MAXUNROLLED 120
+
+/* FULLUNROLL = the most trips of a loop replaced
+ * by copies of its body
+ */
+#define FULLUNROLL 16
+
+/* The nodes added by unrolling are limited to
+ * the larger of MAXUNROLLED and the size of the
+ * program over GROWTH, since TM has room for
+ * only IADDR_SIZE instructions
+ */
+#define GROWTH 2
+
+/* Function treeSize returns the number of nodes
+ * of t and its siblings
+ */
+static int treeSize( TreeNode * t )
+{ int i, n = 0;
+  for (;t != NULL;t=t->sibling)
+  { n++;
+    for (i=0;i<MAXCHILDREN;i++) n += treeSize(t->child[i]);
+  }
+  return n;
+}
+
+/* Function countUses returns the number of
+ * statements of the sequence t, including nested
+ * ones, that assign or read variable v
+ */
+static int countUses( TreeNode * t, int v )
+{ int n = 0;
+  for (;t != NULL;t=t->sibling)
+    switch (t->kind.stmt)
+    { case IfK:
+        n += countUses(t->child[1],v) + countUses(t->child[2],v);
+        break;
+      case RepeatK:
+        n += countUses(t->child[0],v);
+        break;
+      case AssignK:
+      case ReadK:
+        if (t->symbol == v) n++;
+        break;
+      default:
+        break;
+    }
+  return n;
+}
+
+/* isVar is TRUE if expression t is variable v */
+#define isVar(t,v) (((t)->kind.exp == IdK) && ((t)->symbol == (v)))
+
+/* isConst is TRUE if expression t is a constant */
+#define isConst(t) ((t)->kind.exp == ConstK)
+
+/* Function stepOf returns TRUE if statement s
+ * adds a constant to variable v, which is
+ * stored in *step
+ */
+static int stepOf( TreeNode * s, int v, int * step )
+{ TreeNode * e = s->child[0];
+  if ((s->kind.stmt != AssignK) || (s->symbol != v) || (e->kind.exp != OpK))
+    return FALSE;
+  if (((e->attr.op == PLUS) || (e->attr.op == MINUS)) &&
+      isVar(e->child[0],v) && isConst(e->child[1]))
+  { *step = e->child[1]->attr.val;
+    if (e->attr.op == MINUS) *step = evalOp(MINUS,0,*step);
+    return TRUE;
+  }
+  if ((e->attr.op == PLUS) && isConst(e->child[0]) && isVar(e->child[1],v))
+  { *step = e->child[0]->attr.val;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* Function tripCount returns the number of times
+ * the body of repeat loop loop runs if statement
+ * init before it sets its counter, or 0 if it is
+ * not a counted loop
+ */
+static int tripCount( TreeNode * init, TreeNode * loop )
+{ TreeNode * test = loop->child[1];
+  TreeNode * s;
+  int v, x, a, b, k, step = 0, found = FALSE;
+  if ((init->kind.stmt != AssignK) || ! isConst(init->child[0])) return 0;
+  v = init->symbol;
+  if ((test->kind.exp != OpK) || ((test->attr.op != LT) && (test->attr.op != EQ)))
+    return 0;
+  if (! (isVar(test->child[0],v) && isConst(test->child[1])) &&
+      ! (isConst(test->child[0]) && isVar(test->child[1],v)))
+    return 0;
+  for (s=loop->child[0];(s != NULL) && ! found;s=s->sibling)
+    found = stepOf(s,v,&step);
+  if (! found || (step == 0) || (countUses(loop->child[0],v) != 1)) return 0;
+  x = init->child[0]->attr.val;
+  for (k=1;k<=MAXTRIPS;k++)
+  { x = evalOp(PLUS,x,step);
+    a = isConst(test->child[0]) ? test->child[0]->attr.val : x;
+    b = isConst(test->child[1]) ? test->child[1]->attr.val : x;
+    if (evalOp(test->attr.op,a,b)) return k;
+  }
+  return 0;
+}
+
+/* Function append links sequence t at *tail and
+ * returns the new tail
+ */
+static TreeNode ** append( TreeNode ** tail, TreeNode * t )
+{ *tail = t;
+  while (*tail != NULL) tail = &(*tail)->sibling;
+  return tail;
+}
+
+/* Function unrollLoop returns the statements that
+ * replace repeat loop loop whose body runs trips
+ * times: trips copies of the body if it is small,
+ * otherwise the remaining trips and a loop with
+ * UnrollFactor copies of the body. The nodes
+ * copied are taken from *budget
+ */
+static TreeNode * unrollLoop( Context * ctx, TreeNode * loop, int trips,
+                              int * budget )
+{ TreeNode * body = loop->child[0];
+  TreeNode * head = NULL, * copies = NULL;
+  TreeNode ** tail = &head, ** ctail = &copies;
+  int k, size = treeSize(body);
+  if ((trips <= FULLUNROLL) && (trips*size <= MAXUNROLLED) &&
+      ((trips-1)*size <= *budget))
+  { *budget -= (trips-1)*size;
+    for (k=1;k<trips;k++) tail = append(tail,copyTree(ctx,body));
+    append(tail,body);
+    loop->child[0] = NULL;
+    freeTree(loop);
+    return head;
+  }
+  if ((UnrollFactor < 2) || (trips < UnrollFactor) ||
+      (UnrollFactor*size > MAXUNROLLED) ||
+      ((trips%UnrollFactor+UnrollFactor-1)*size > *budget))
+    return loop;
+  *budget -= (trips%UnrollFactor+UnrollFactor-1)*size;
+  for (k=0;k<trips%UnrollFactor;k++) tail = append(tail,copyTree(ctx,body));
+  for (k=1;k<UnrollFactor;k++) ctail = append(ctail,copyTree(ctx,body));
+  append(append(&loop->child[0],body),copies);
+  append(tail,loop);
+  return head;
+}
+
+/* Function cold returns TRUE if the profile says
+ * that the body of repeat loop t never ran
+ */
+static int cold( Context * ctx, TreeNode * t )
+{ long count, ntrue;
+  return siteCounts(ctx,t->site,&count,&ntrue) && (count == 0);
+}
+
+/* Function unrollStmts unrolls the counted loops
+ * in the statement sequence t, inner loops first,
+ * within *budget and returns the new sequence
+ */
+static TreeNode * unrollStmts( Context * ctx, TreeNode * t, int * budget )
+{ TreeNode * head = NULL;
+  TreeNode ** tail = &head;
+  TreeNode * prev = NULL; /* the statement before t */
+  int trips;
+  while (t != NULL)
+  { TreeNode * next = t->sibling;
+    TreeNode * s = t; /* what t is replaced by */
+    t->sibling = NULL;
+    switch (t->kind.stmt)
+    { case IfK:
+        t->child[1] = unrollStmts(ctx,t->child[1],budget);
+        t->child[2] = unrollStmts(ctx,t->child[2],budget);
+        break;
+      case RepeatK:
+        t->child[0] = unrollStmts(ctx,t->child[0],budget);
+        if ((prev != NULL) && ! cold(ctx,t) && ((trips = tripCount(prev,t)) > 0))
+          s = unrollLoop(ctx,t,trips,budget);
+        break;
+      default:
+        break;
+    }
+    for (*tail = s;*tail != NULL;tail = &(*tail)->sibling) prev = *tail;
+    t = next;
+  }
+  return head;
+}
+
+TreeNode * unrollLoops( Context * ctx, TreeNode * syntaxTree )
+{ int budget = treeSize(syntaxTree)/GROWTH;
+  if (budget < MAXUNROLLED) budget = MAXUNROLLED;
+  return unrollStmts(ctx,syntaxTree,&budget);
+}
@@ -0,0 +1,26 @@
+/****************************************************/
+/* File: unroll.h                                   */
+/* Unrolling of counted repeat loops on the syntax */
+/* tree for the TINY compiler                       */
+/* Compiler Construction: Principles and Practice   */
+/****************************************************/
+
+#ifndef _UNROLL_H_
+#define _UNROLL_H_
+
+/* Function unrollLoops unrolls the counted repeat
+ * loops of the type checked syntax tree: loops
+ * whose counter is set to a constant just before
+ * the loop, changed only by adding a constant once
+ * in the body, and compared with a constant in the
+ * test. A loop that runs few times is replaced by
+ * copies of its body; otherwise the body is copied
+ * UnrollFactor times inside the loop and the
+ * remaining iterations run before it, as long
+ * as the program grows by at most half. Loops
+ * that never ran according to the profile are
+ * left alone. It returns the new tree
+ */
+TreeNode * unrollLoops(Context * ctx, TreeNode * syntaxTree);
+
+#endif
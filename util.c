@@ -8,11 +8,12 @@
 
 #include "globals.h"
 #include "util.h"
+#include "symtab.h"
 
 /* Procedure printToken prints a token 
  * and its lexeme to the listing file
  */
-void printToken( TokenType token, const char* tokenString )
+void printToken( Context * ctx, TokenType token, const char* tokenString )
 { switch (token)
     // 8个保留字
   { case IF:
@@ -23,55 +24,60 @@ void printToken( TokenType token, const char* tokenString )
     case UNTIL:
     case READ:
     case WRITE:
-      fprintf(listing,
+      fprintf(ctx->listing,
          "reserved word: %s\n",tokenString);
       break;
     // 10个运算符+1个文件结束符
-    case ASSIGN: fprintf(listing,":=\n"); break;
-    case LT: fprintf(listing,"<\n"); break;
-    case EQ: fprintf(listing,"=\n"); break;
-    case LPAREN: fprintf(listing,"(\n"); break;
-    case RPAREN: fprintf(listing,")\n"); break;
-    case SEMI: fprintf(listing,";\n"); break;
-    case PLUS: fprintf(listing,"+\n"); break;
-    case MINUS: fprintf(listing,"-\n"); break;
-    case TIMES: fprintf(listing,"*\n"); break;
-    case OVER: fprintf(listing,"/\n"); break;
-    case ENDFILE: fprintf(listing,"EOF\n"); break;
+    case ASSIGN: fprintf(ctx->listing,":=\n"); break;
+    case LT: fprintf(ctx->listing,"<\n"); break;
+    case EQ: fprintf(ctx->listing,"=\n"); break;
+    case LPAREN: fprintf(ctx->listing,"(\n"); break;
+    case RPAREN: fprintf(ctx->listing,")\n"); break;
+    case SEMI: fprintf(ctx->listing,";\n"); break;
+    case PLUS: fprintf(ctx->listing,"+\n"); break;
+    case MINUS: fprintf(ctx->listing,"-\n"); break;
+    case TIMES: fprintf(ctx->listing,"*\n"); break;
+    case OVER: fprintf(ctx->listing,"/\n"); break;
+    case ENDFILE: fprintf(ctx->listing,"EOF\n"); break;
     // 2类标识符
     case NUM:
-      fprintf(listing,
+      fprintf(ctx->listing,
           "NUM, val= %s\n",tokenString);
       break;
     case ID:
-      fprintf(listing,
+      fprintf(ctx->listing,
           "ID, name= %s\n",tokenString);
       break;
     // 错误状态
     case ERROR:
-      fprintf(listing,
+      fprintf(ctx->listing,
           "ERROR: %s\n",tokenString);
       break;
     default: /* should never happen */
-      fprintf(listing,"Unknown token: %d\n",token);
+      fprintf(ctx->listing,"Unknown token: %d\n",token);
   }
 }
 
 /* Function newStmtNode creates a new statement
  * node for syntax tree construction
  */
-TreeNode * newStmtNode(StmtKind kind)
+TreeNode * newStmtNode(Context * ctx, StmtKind kind)
 { TreeNode * t = (TreeNode *) malloc(sizeof(TreeNode));
   int i;
   if (t==NULL)
-    fprintf(listing,"Out of memory error at line %d\n",lineno);
+    fprintf(ctx->listing,"Out of memory error at line %d\n",ctx->lineno);
   else {
+    ctx->nnodes++;
+    ctx->allocBytes += sizeof(TreeNode);
     // 填入5个属性值
     for (i=0;i<MAXCHILDREN;i++) t->child[i] = NULL;
     t->sibling = NULL;
     t->nodekind = StmtK;
     t->kind.stmt = kind;
-    t->lineno = lineno;
+    t->lineno = ctx->lineno;
+    t->symbol = -1;
+    t->site = -1;
+    t->need = 0;
     // 语句statement没有type，所以没有填
     // 另外attr也没有填
   }
@@ -81,18 +87,23 @@ TreeNode * newStmtNode(StmtKind kind)
 /* Function newExpNode creates a new expression 
  * node for syntax tree construction
  */
-TreeNode * newExpNode(ExpKind kind)
+TreeNode * newExpNode(Context * ctx, ExpKind kind)
 { TreeNode * t = (TreeNode *) malloc(sizeof(TreeNode));
   int i;
   if (t==NULL)
-    fprintf(listing,"Out of memory error at line %d\n",lineno);
+    fprintf(ctx->listing,"Out of memory error at line %d\n",ctx->lineno);
   else {
+    ctx->nnodes++;
+    ctx->allocBytes += sizeof(TreeNode);
     for (i=0;i<MAXCHILDREN;i++) t->child[i] = NULL;
     t->sibling = NULL;
     t->nodekind = ExpK;
     t->kind.exp = kind;
-    t->lineno = lineno;
+    t->lineno = ctx->lineno;
     t->type = Void; // 表达式expression有type，先填上Void型
+    t->symbol = -1;
+    t->site = -1;
+    t->need = 0;
     // 另外attr也没有填
   }
   return t;
@@ -101,87 +112,157 @@ TreeNode * newExpNode(ExpKind kind)
 /* Function copyString allocates and makes a new
  * copy of an existing string
  */
-char * copyString(char * s)
+char * copyString(Context * ctx, char * s)
 { int n;
   char * t;
   if (s==NULL) return NULL;
   n = strlen(s)+1;
   t = malloc(n);
   if (t==NULL)
-    fprintf(listing,"Out of memory error at line %d\n",lineno);
-  else strcpy(t,s);
+    fprintf(ctx->listing,"Out of memory error at line %d\n",ctx->lineno);
+  else
+  { ctx->allocBytes += n;
+    strcpy(t,s);
+  }
   return t;
 }
 
-/* Variable indentno is used by printTree to
- * store current number of spaces to indent
+/* macros to increase/decrease indentation;
+ * ctx->indentno stores the current number of
+ * spaces to indent used by printTree
  */
-static indentno = 0;
-
-/* macros to increase/decrease indentation */
 // 缩进值为2
-#define INDENT indentno+=2
-#define UNINDENT indentno-=2
+#define INDENT ctx->indentno+=2
+#define UNINDENT ctx->indentno-=2
 
 /* printSpaces indents by printing spaces */
-static void printSpaces(void)
+static void printSpaces(Context * ctx)
 { int i;
-  for (i=0;i<indentno;i++)
-    fprintf(listing," ");
+  for (i=0;i<ctx->indentno;i++)
+    fprintf(ctx->listing," ");
 }
 
 /* procedure printTree prints a syntax tree to the 
  * listing file using indentation to indicate subtrees
  */
-void printTree( TreeNode * tree )
+void printTree( Context * ctx, TreeNode * tree )
 { int i;
   INDENT; // 向右缩进
   while (tree != NULL) {
-    printSpaces();
+    printSpaces(ctx);
     if (tree->nodekind==StmtK)
     { switch (tree->kind.stmt) {
         case IfK:
-          fprintf(listing,"If\n");
+          fprintf(ctx->listing,"If\n");
           break;
         case RepeatK:
-          fprintf(listing,"Repeat\n");
+          fprintf(ctx->listing,"Repeat\n");
           break;
         case AssignK:
-          fprintf(listing,"Assign to: %s\n",tree->attr.name); // 属性由意义的要打印
+          fprintf(ctx->listing,"Assign to: %s\n",tree->attr.name); // 属性由意义的要打印
           break;
         case ReadK:
-          fprintf(listing,"Read: %s\n",tree->attr.name);
+          fprintf(ctx->listing,"Read: %s\n",tree->attr.name);
           break;
         case WriteK:
-          fprintf(listing,"Write\n");
+          fprintf(ctx->listing,"Write\n");
           break;
         default:
-          fprintf(listing,"Unknown ExpNode kind\n");
+          fprintf(ctx->listing,"Unknown ExpNode kind\n");
           break;
       }
     }
     else if (tree->nodekind==ExpK)
     { switch (tree->kind.exp) {
         case OpK:
-          fprintf(listing,"Op: ");
-          printToken(tree->attr.op,"\0"); // 这里比较特殊，用到printToken函数
+          fprintf(ctx->listing,"Op: ");
+          printToken(ctx,tree->attr.op,"\0"); // 这里比较特殊，用到printToken函数
           break;
         case ConstK:
-          fprintf(listing,"Const: %d\n",tree->attr.val);
+          fprintf(ctx->listing,"Const: %d\n",tree->attr.val);
           break;
         case IdK:
-          fprintf(listing,"Id: %s\n",tree->attr.name);
+          fprintf(ctx->listing,"Id: %s\n",tree->attr.name);
           break;
         default:
-          fprintf(listing,"Unknown ExpNode kind\n");
+          fprintf(ctx->listing,"Unknown ExpNode kind\n");
           break;
       }
     }
-    else fprintf(listing,"Unknown node kind\n");
+    else fprintf(ctx->listing,"Unknown node kind\n");
 
     for (i=0;i<MAXCHILDREN;i++) // 打印所有子树：递归
-         printTree(tree->child[i]);
+         printTree(ctx,tree->child[i]);
     tree = tree->sibling; // 打印下棵兄弟树：循环
   }
   UNINDENT; // 向左缩进
 }
+
+/* Procedure freeTree releases a syntax tree
+ * together with the names stored in its nodes
+ */
+void freeTree( TreeNode * tree )
+{ int i;
+  while (tree != NULL) {
+    TreeNode * next = tree->sibling;
+    for (i=0;i<MAXCHILDREN;i++) // 子树递归释放，兄弟结点循环释放
+      freeTree(tree->child[i]);
+    if (((tree->nodekind==StmtK) &&
+         ((tree->kind.stmt==AssignK) || (tree->kind.stmt==ReadK))) ||
+        ((tree->nodekind==ExpK) && (tree->kind.exp==IdK)))
+      free(tree->attr.name);
+    free(tree);
+    tree = next;
+  }
+}
+
+/* Function copyTree returns a copy of the syntax
+ * tree t and its siblings; the copies of if and
+ * repeat statements have no profile site
+ */
+TreeNode * copyTree( Context * ctx, TreeNode * t )
+{ TreeNode * head = NULL;
+  TreeNode ** tail = &head;
+  int i;
+  for (;t != NULL;t=t->sibling)
+  { TreeNode * c = (TreeNode *) malloc(sizeof(TreeNode));
+    ctx->nnodes++;
+    ctx->allocBytes += sizeof(TreeNode);
+    *c = *t;
+    c->sibling = NULL;
+    c->site = -1; /* the profile counts of t are not those of the copy */
+    for (i=0;i<MAXCHILDREN;i++) c->child[i] = copyTree(ctx,t->child[i]);
+    if (((t->nodekind==StmtK) &&
+         ((t->kind.stmt==AssignK) || (t->kind.stmt==ReadK))) ||
+        ((t->nodekind==ExpK) && (t->kind.exp==IdK)))
+      c->attr.name = copyString(ctx,t->attr.name);
+    *tail = c;
+    tail = &c->sibling;
+  }
+  return head;
+}
+
+/* Function newContext allocates the state of a
+ * single compilation, reading from source and
+ * writing the listing to listing
+ */
+Context * newContext( FILE * source, FILE * listing )
+{ Context * ctx = (Context *) calloc(1,sizeof(Context));
+  if (ctx==NULL) return NULL;
+  ctx->source = source;
+  ctx->listing = listing;
+  ctx->Error = FALSE;
+  ctx->symtab = st_new();
+  return ctx;
+}
+
+/* Procedure freeContext releases a compilation
+ * context together with its symbol table
+ */
+void freeContext( Context * ctx )
+{ if (ctx==NULL) return;
+  st_free(ctx->symtab);
+  free(ctx->report);
+  free(ctx->profile);
+  free(ctx);
+}
@@ -16,26 +16,48 @@
 /* Procedure printToken prints a token 
  * and its lexeme to the listing file
  */
-void printToken( TokenType, const char* );
+void printToken( Context *, TokenType, const char* );
 
 /* Function newStmtNode creates a new statement
  * node for syntax tree construction
  */
-TreeNode * newStmtNode(StmtKind);
+TreeNode * newStmtNode(Context *, StmtKind);
 
 /* Function newExpNode creates a new expression 
  * node for syntax tree construction
  */
-TreeNode * newExpNode(ExpKind);
+TreeNode * newExpNode(Context *, ExpKind);
 
 /* Function copyString allocates and makes a new
  * copy of an existing string
  */
-char * copyString( char * );
+char * copyString( Context *, char * );
 
 /* procedure printTree prints a syntax tree to the 
  * listing file using indentation to indicate subtrees
  */
-void printTree( TreeNode * );
+void printTree( Context *, TreeNode * );
+
+/* Procedure freeTree releases a syntax tree
+ * together with the names stored in its nodes
+ */
+void freeTree( TreeNode * );
+
+/* Function copyTree returns a copy of the syntax
+ * tree t and its siblings; the copies of if and
+ * repeat statements have no profile site
+ */
+TreeNode * copyTree( Context *, TreeNode * );
+
+/* Function newContext allocates the state of a
+ * single compilation, reading from source and
+ * writing the listing to listing
+ */
+Context * newContext( FILE * source, FILE * listing );
+
+/* Procedure freeContext releases a compilation
+ * context together with its symbol table
+ */
+void freeContext( Context * );
 
 #endif
@@ -20,6 +20,9 @@ static char * savedName; /* for use in assignments */
 static int savedLineNo;  /* ditto */
 
 static TreeNode * savedTree; /* stores syntax tree for later return */
+// Yacc/Bison生成的分析器本身使用全局状态，不可重入，
+// 因此只能把当前编译的Context保存在这里
+static Context * ctx; /* context of the current parse */
 static int yylex(void); // added 11/2/11 to ensure no conflict with lex
 
 // 下面这些符号从 global.h 挪过来
@@ -56,53 +59,53 @@ stmt        : if_stmt { $$ = $1; }
             | error  { $$ = NULL; /* 错误处理1 */ }
             ;
 if_stmt     : IF exp THEN stmt_seq END
-                 { $$ = newStmtNode(IfK);
+                 { $$ = newStmtNode(ctx,IfK);
                    $$->child[0] = $2;
                    $$->child[1] = $4;
                  }
             | IF exp THEN stmt_seq ELSE stmt_seq END
-                 { $$ = newStmtNode(IfK);
+                 { $$ = newStmtNode(ctx,IfK);
                    $$->child[0] = $2;
                    $$->child[1] = $4;
                    $$->child[2] = $6;
                  }
             ;
 repeat_stmt : REPEAT stmt_seq UNTIL exp
-                 { $$ = newStmtNode(RepeatK);
+                 { $$ = newStmtNode(ctx,RepeatK);
                    $$->child[0] = $2;
                    $$->child[1] = $4;
                  }
             ;
-assign_stmt : ID { savedName = copyString(tokenString);
-                   savedLineNo = lineno; 
+assign_stmt : ID { savedName = copyString(ctx,ctx->tokenString);
+                   savedLineNo = ctx->lineno; 
                    // 注意这两句是嵌入式操作，在两个BNF标志符的中间
                  }
               ASSIGN exp
-                 { $$ = newStmtNode(AssignK);
+                 { $$ = newStmtNode(ctx,AssignK);
                    $$->child[0] = $4;
                    $$->attr.name = savedName;
                    $$->lineno = savedLineNo;
                  }
             ;
 read_stmt   : READ ID
-                 { $$ = newStmtNode(ReadK);
+                 { $$ = newStmtNode(ctx,ReadK);
                    $$->attr.name =
-                     copyString(tokenString);
+                     copyString(ctx,ctx->tokenString);
                  }
             ;
 write_stmt  : WRITE exp
-                 { $$ = newStmtNode(WriteK);
+                 { $$ = newStmtNode(ctx,WriteK);
                    $$->child[0] = $2;
                  }
             ;
 exp         : simple_exp LT simple_exp 
-                 { $$ = newExpNode(OpK);
+                 { $$ = newExpNode(ctx,OpK);
                    $$->child[0] = $1;
                    $$->child[1] = $3;
                    $$->attr.op = LT;
                  }
             | simple_exp EQ simple_exp
-                 { $$ = newExpNode(OpK);
+                 { $$ = newExpNode(ctx,OpK);
                    $$->child[0] = $1;
                    $$->child[1] = $3;
                    $$->attr.op = EQ;
@@ -110,13 +113,13 @@ exp         : simple_exp LT simple_exp
             | simple_exp { $$ = $1; }
             ;
 simple_exp  : simple_exp PLUS term 
-                 { $$ = newExpNode(OpK);
+                 { $$ = newExpNode(ctx,OpK);
                    $$->child[0] = $1;
                    $$->child[1] = $3;
                    $$->attr.op = PLUS;
                  }
             | simple_exp MINUS term
-                 { $$ = newExpNode(OpK);
+                 { $$ = newExpNode(ctx,OpK);
                    $$->child[0] = $1;
                    $$->child[1] = $3;
                    $$->attr.op = MINUS;
@@ -124,13 +127,13 @@ simple_exp  : simple_exp PLUS term
             | term { $$ = $1; }
             ;
 term        : term TIMES factor 
-                 { $$ = newExpNode(OpK);
+                 { $$ = newExpNode(ctx,OpK);
                    $$->child[0] = $1;
                    $$->child[1] = $3;
                    $$->attr.op = TIMES;
                  }
             | term OVER factor
-                 { $$ = newExpNode(OpK);
+                 { $$ = newExpNode(ctx,OpK);
                    $$->child[0] = $1;
                    $$->child[1] = $3;
                    $$->attr.op = OVER;
@@ -140,12 +143,12 @@ term        : term TIMES factor
 factor      : LPAREN exp RPAREN
                  { $$ = $2; }
             | NUM
-                 { $$ = newExpNode(ConstK);
-                   $$->attr.val = atoi(tokenString);
+                 { $$ = newExpNode(ctx,ConstK);
+                   $$->attr.val = atoi(ctx->tokenString);
                  }
-            | ID { $$ = newExpNode(IdK);
+            | ID { $$ = newExpNode(ctx,IdK);
                    $$->attr.name =
-                         copyString(tokenString);
+                         copyString(ctx,ctx->tokenString);
                  }
             | error { $$ = NULL; /* 错误处理2 */ }
             ;
@@ -153,10 +156,10 @@ factor      : LPAREN exp RPAREN
 %%
 
 int yyerror(char * message)
-{ fprintf(listing,"Syntax error at line %d: %s\n",lineno,message);
-  fprintf(listing,"Current token: ");
-  printToken(yychar,tokenString); // yychar是yacc的内置变量
-  Error = TRUE;
+{ fprintf(ctx->listing,"Syntax error at line %d: %s\n",ctx->lineno,message);
+  fprintf(ctx->listing,"Current token: ");
+  printToken(ctx,yychar,ctx->tokenString); // yychar是yacc的内置变量
+  ctx->Error = TRUE;
   return 0;
 }
 
@@ -166,11 +169,12 @@ int yyerror(char * message)
 // 再次包装getToken()
 // 总体关系：yylex[.l] -> getToken[public] -> yylex[.y]
 static int yylex(void)
-{ return getToken(); }
+{ return getToken(ctx); }
 
 // 包装：yyparse()
-TreeNode * parse(void)
-{ yyparse(); // yyparse()只能返回一个整数
+TreeNode * parse(Context * c)
+{ ctx = c;
+  yyparse(); // yyparse()只能返回一个整数
   return savedTree;
 }
 